@@ -0,0 +1,222 @@
+//
+//  chip8-audio.c
+//  first c++ project
+//
+//  The beep. The emulation thread publishes the sound timer whenever the
+//  program sets it, together with the XO-CHIP pattern and pitch, and the
+//  audio callback picks that up at the start of its next buffer. It plays
+//  exactly timer / 60 seconds of the pattern, counting the samples down
+//  itself in between, and resamples the pattern to the device rate by
+//  averaging it over each output sample so high pitches don't alias.
+//
+
+#include "chip8.h"
+
+#include <string.h>
+
+// request holds the timer, the pitch, whether the timer was written and
+// the publication count, so the same timer published again after the
+// last beep ended still starts a new one
+#define AUDIO_PITCH_SHIFT 8
+#define AUDIO_RESTART (1u << 16)
+#define AUDIO_COUNT_SHIFT 17
+
+#define PATTERN_BITS 128
+// positions are 16.16 fixed point bits, the pattern is a power of two long
+#define PATTERN_MASK ((PATTERN_BITS << 16) - 1)
+#define PATTERN_WRAP_SHIFT 23
+
+// pitch 64 plays the pattern at 4000 bits per second, every 48 steps
+// doubles it
+#define PITCH_BASE_HZ 4000.0
+#define PITCH_CENTER 64
+#define PITCH_OCTAVE 48
+#define PITCH_STEP 1.0145453349375237 // 2^(1/48)
+
+static uint32_t pitch_step(uint32_t rate, uint8_t pitch)
+{
+    double hz = PITCH_BASE_HZ;
+    int steps = pitch - PITCH_CENTER;
+
+    for (; steps < 0; steps += PITCH_OCTAVE)
+    {
+        hz /= 2;
+    }
+    for (; steps >= PITCH_OCTAVE; steps -= PITCH_OCTAVE)
+    {
+        hz *= 2;
+    }
+    while (steps-- > 0)
+    {
+        hz *= PITCH_STEP;
+    }
+
+    uint32_t step = hz * 65536 / rate;
+    return step > 0 ? step : 1;
+}
+
+// callback side, rebuilds the tables the resampler reads from
+static void load_pattern(struct Chip8Audio *audio, const uint32_t words[4], uint8_t pitch)
+{
+    for (int i = 0; i < PATTERN_BITS; i++)
+    {
+        uint8_t bit = words[i / 32] >> (31 - i % 32) & 1;
+        audio->bits[i] = bit;
+        audio->bits[i + PATTERN_BITS] = bit;
+    }
+
+    audio->ones[0] = 0;
+    for (int i = 1; i < 2 * PATTERN_BITS; i++)
+    {
+        audio->ones[i] = audio->ones[i - 1] + audio->bits[i - 1];
+    }
+    audio->total = audio->ones[PATTERN_BITS];
+
+    audio->step = pitch_step(audio->rate, pitch);
+    audio->gain = (2 * CHIP8_AUDIO_VOLUME << 16) / audio->step;
+}
+
+// area under the pattern from its start up to position, 16.16
+static inline uint32_t integral(const struct Chip8Audio *audio, uint32_t position)
+{
+    uint32_t whole = position >> 16;
+    return ((uint32_t)audio->ones[whole] << 16) + audio->bits[whole] * (position & 0xFFFF);
+}
+
+void chip8_audio_init(struct Chip8Audio *audio, uint32_t rate)
+{
+    memset(audio, 0, sizeof(*audio));
+    atomic_init(&audio->request, 0);
+    for (int slot = 0; slot < 2; slot++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            atomic_init(&audio->pattern[slot][i], 0);
+        }
+    }
+
+    // pitch and pattern start out zero, so the first update publishes the
+    // machine's own
+    audio->rate = rate;
+    const uint32_t silent[4] = {0};
+    load_pattern(audio, silent, PITCH_CENTER);
+}
+
+static void publish(struct Chip8Audio *audio, bool restart)
+{
+    audio->count++;
+    int slot = audio->count & 1;
+
+    // the callback may still be reading this slot from two publications
+    // ago, it notices by the count changing under it and reads again
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < 4; i++)
+    {
+        const uint8_t *bytes = &audio->last_pattern[i * 4];
+        uint32_t word = (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+        atomic_store_explicit(&audio->pattern[slot][i], word, memory_order_relaxed);
+    }
+
+    uint32_t request = audio->count << AUDIO_COUNT_SHIFT | (restart ? AUDIO_RESTART : 0) |
+                       audio->pitch << AUDIO_PITCH_SHIFT | audio->sound_timer;
+    atomic_store_explicit(&audio->request, request, memory_order_release);
+}
+
+void chip8_audio_update(struct Chip8Audio *audio, const struct Chip8 *chip8)
+{
+    bool restart = chip8->sound_timer != audio->sound_timer;
+    bool changed = chip8->pitch != audio->pitch ||
+                   memcmp(chip8->audio_pattern, audio->last_pattern, sizeof(audio->last_pattern)) != 0;
+
+    if (restart || changed)
+    {
+        audio->sound_timer = chip8->sound_timer;
+        audio->pitch = chip8->pitch;
+        memcpy(audio->last_pattern, chip8->audio_pattern, sizeof(audio->last_pattern));
+        publish(audio, restart);
+    }
+}
+
+void chip8_audio_tick(struct Chip8Audio *audio, const struct Chip8 *chip8)
+{
+    audio->sound_timer = chip8->sound_timer;
+}
+
+void chip8_audio_silence(struct Chip8Audio *audio)
+{
+    if (audio->sound_timer != 0)
+    {
+        audio->sound_timer = 0;
+        publish(audio, true);
+    }
+}
+
+// callback side, takes over whatever was published since the last buffer
+static void receive(struct Chip8Audio *audio)
+{
+    uint32_t request = atomic_load_explicit(&audio->request, memory_order_acquire);
+    if (request == audio->seen)
+    {
+        return;
+    }
+
+    uint32_t words[4];
+    for (;;)
+    {
+        int slot = request >> AUDIO_COUNT_SHIFT & 1;
+        for (int i = 0; i < 4; i++)
+        {
+            words[i] = atomic_load_explicit(&audio->pattern[slot][i], memory_order_relaxed);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t again = atomic_load_explicit(&audio->request, memory_order_relaxed);
+        if (again == request)
+        {
+            break;
+        }
+        request = again;
+    }
+
+    // a timer written since the last buffer counts, even if a later
+    // publication only changed the pattern
+    bool restart = (request & AUDIO_RESTART) ||
+                   (request >> AUDIO_COUNT_SHIFT) - (audio->seen >> AUDIO_COUNT_SHIFT) > 1;
+    audio->seen = request;
+    load_pattern(audio, words, request >> AUDIO_PITCH_SHIFT & 0xFF);
+
+    if (restart)
+    {
+        // a beep that starts from silence starts at the top of the pattern
+        if (audio->remaining == 0)
+        {
+            audio->position = 0;
+        }
+        audio->remaining = (uint64_t)(request & 0xFF) * audio->rate / CHIP8_TIMER_HZ;
+    }
+}
+
+void chip8_audio_render(struct Chip8Audio *audio, uint8_t *stream, size_t samples)
+{
+    receive(audio);
+
+    size_t tone = samples < audio->remaining ? samples : audio->remaining;
+    uint32_t position = audio->position;
+    uint32_t before = integral(audio, position);
+    uint32_t wrapped_area = (uint32_t)audio->total << 16;
+
+    // each sample is the pattern averaged over the step it covers. no
+    // branches in here, wrapping around the end of the pattern is a shift
+    for (size_t i = 0; i < tone; i++)
+    {
+        uint32_t next = position + audio->step;
+        uint32_t after = integral(audio, next);
+        stream[i] = CHIP8_AUDIO_SILENCE - CHIP8_AUDIO_VOLUME + ((uint64_t)(after - before) * audio->gain >> 16);
+        before = after - (next >> PATTERN_WRAP_SHIFT) * wrapped_area;
+        position = next & PATTERN_MASK;
+    }
+
+    memset(stream + tone, CHIP8_AUDIO_SILENCE, samples - tone);
+    audio->position = position;
+    audio->remaining -= tone;
+}
@@ -0,0 +1,494 @@
+//
+//  chip8-bench.c
+//  first c++ project
+//
+//  Interpreter throughput benchmark. Times each opcode family on a small
+//  synthetic loop, then runs every ROM for a fixed number of instructions,
+//  restarting it whenever it halts, and reports instructions per second.
+//  Last it times resetting a tree search child to its parent, a plain copy
+//  of the machine against chip8_fork and chip8_rollback. --json writes the
+//  same numbers out for tracking across releases.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+
+#define DEFAULT_CYCLES 50000000
+#define DEFAULT_MICRO_CYCLES 20000000
+#define DEFAULT_IPS 700
+// synthetic loops repeat their body up to this many instructions before
+// jumping back, so the jump costs about 3% of each measurement
+#define MICRO_LOOP 32
+#define MICRO_START (PROGRAM_START + 8)
+// CALL benchmarks jump here
+#define MICRO_SUBROUTINE 0x400
+#define DEFAULT_FORK_ROLLOUTS 1000000
+// the parent is this far into the rom, each rollout then runs a child this
+// many instructions with a key of its own held down
+#define FORK_WARMUP 100000
+#define FORK_ROLLOUT 64
+
+// one opcode family: the setup runs once, the body is repeated to fill the
+// loop. every skip in a body is never taken, and nothing walks out of memory
+struct MicroBench
+{
+    const char *name;
+    uint16_t setup[4];
+    uint16_t body[4];
+};
+
+static const struct MicroBench micro_benches[] = {
+    {"ld_vx_nn", {0}, {0x6012, 0x6134, 0x6256, 0x6378}},
+    {"add_vx_nn", {0}, {0x7001, 0x7102, 0x7203, 0x7304}},
+    {"alu_8xyn", {0x6105, 0x6207}, {0x8014, 0x8125, 0x8231, 0x830E}},
+    {"skip", {0x6001, 0x6102}, {0x3000, 0x4001, 0x5010, 0x9000}},
+    {"ld_i", {0}, {0xA300, 0xA310, 0xA320, 0xA330}},
+    {"add_i", {0xA300, 0x6001}, {0xF01E, 0xF01E, 0xF01E, 0xF01E}},
+    {"rnd", {0}, {0xC0FF, 0xC10F, 0xC2F0, 0xC3AA}},
+    {"timers", {0x6010}, {0xF015, 0xF107, 0xF018, 0xF207}},
+    {"call_ret", {0}, {0x2000 | MICRO_SUBROUTINE}},
+    {"cls", {0}, {0x00E0}},
+    {"drw", {0xA050, 0x6008, 0x6104}, {0xD015, 0xD105, 0xD015, 0xD105}},
+    {"bcd_fx33", {0xA300, 0x60FE}, {0xF033}},
+    // FX55 and FX65 advance I, so I is pointed back before each one
+    {"store_fx55", {0}, {0xA300, 0xFF55}},
+    {"load_fx65", {0}, {0xA300, 0xFF65}},
+};
+
+#define MICRO_BENCHES (sizeof(micro_benches) / sizeof(micro_benches[0]))
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(const char *program)
+{
+    printf("usage: %s [--cycles K] [--micro-cycles K] [--interp | --legacy | --jit]\n"
+           "       [--fork-rollouts K] [--json FILE] rom...\n", program);
+    printf("  --cycles K        instructions to run per rom (default %d)\n", DEFAULT_CYCLES);
+    printf("  --micro-cycles K  instructions to run per opcode family, 0 skips them (default %d)\n", DEFAULT_MICRO_CYCLES);
+    printf("  --interp          decode every instruction instead of running cached blocks\n");
+    printf("  --legacy          like --interp, but decode through the nested switches used\n");
+    printf("                    before the opcode table\n");
+    printf("  --jit             translate hot blocks to native code (x86-64 only)\n");
+    printf("  --fork-rollouts K children to reset per rom, 0 skips them (default %d)\n", DEFAULT_FORK_ROLLOUTS);
+    printf("  --json FILE       also write the results to FILE as JSON\n");
+}
+
+struct Runner
+{
+    bool interp;
+    bool legacy;
+    struct Chip8Cache *cache;
+    struct Chip8Jit *jit;
+};
+
+static uint64_t run(struct Runner *runner, struct Chip8 *chip8, uint64_t cycles)
+{
+    if (runner->jit != NULL)
+    {
+        return chip8_run_jit(chip8, runner->jit, cycles, DEFAULT_IPS / 60);
+    }
+    else if (runner->legacy)
+    {
+        return chip8_run_legacy(chip8, cycles, DEFAULT_IPS / 60);
+    }
+    else if (runner->interp)
+    {
+        return chip8_run(chip8, cycles, DEFAULT_IPS / 60);
+    }
+    return chip8_run_cached(chip8, runner->cache, cycles, DEFAULT_IPS / 60);
+}
+
+static void micro_program(const struct MicroBench *bench, struct Chip8 *chip8)
+{
+    uint8_t program[0x400 - PROGRAM_START + 2] = {0};
+    uint16_t at = PROGRAM_START;
+    int body_length = 0;
+
+    while (body_length < 4 && bench->body[body_length] != 0)
+    {
+        body_length++;
+    }
+
+#define EMIT(opcode)                                        \
+    do                                                      \
+    {                                                       \
+        program[at - PROGRAM_START] = (opcode) >> 8;        \
+        program[at - PROGRAM_START + 1] = (opcode) & 0xFF; \
+        at += 2;                                            \
+    } while (0)
+
+    for (int i = 0; i < 4 && bench->setup[i] != 0; i++)
+    {
+        EMIT(bench->setup[i]);
+    }
+
+    // the loop always starts at the same place, past the longest setup
+    at = MICRO_START;
+    for (int i = 0; i < MICRO_LOOP - 1; i++)
+    {
+        EMIT(bench->body[i % body_length]);
+    }
+    EMIT(0x1000 | MICRO_START);
+
+    at = MICRO_SUBROUTINE;
+    EMIT(0x00EE);
+#undef EMIT
+
+    // a setup shorter than 4 instructions falls through 8000s into the loop
+    for (uint16_t pc = PROGRAM_START; pc < MICRO_START; pc += 2)
+    {
+        if (program[pc - PROGRAM_START] == 0 && program[pc - PROGRAM_START + 1] == 0)
+        {
+            program[pc - PROGRAM_START] = 0x80;
+        }
+    }
+
+    initialize_chip8(chip8);
+    load_program_from_buffer(program, sizeof(program), chip8);
+}
+
+// nanoseconds per child for each way of resetting it, bare and around a
+// rollout. the children all run on the plain interpreter, so the numbers
+// don't depend on a cache
+struct ForkBench
+{
+    double copy;
+    double fork;
+    double copy_rollout;
+    double fork_rollout;
+};
+
+static void fork_bench(const struct Chip8 *rom, uint64_t rollouts, struct ForkBench *result)
+{
+    static struct Chip8 parent;
+    static struct Chip8 child;
+
+    parent = *rom;
+    chip8_run(&parent, FORK_WARMUP, DEFAULT_IPS / 60);
+
+    // the key press keeps the compiler from dropping the copies
+    double start = now_seconds();
+    for (uint64_t i = 0; i < rollouts; i++)
+    {
+        memcpy(&child, &parent, sizeof(struct Chip8));
+        handle_keypres(&child, i & 15, true);
+    }
+    result->copy = (now_seconds() - start) * 1e9 / rollouts;
+
+    start = now_seconds();
+    for (uint64_t i = 0; i < rollouts; i++)
+    {
+        chip8_fork(&child, &parent);
+        handle_keypres(&child, i & 15, true);
+        chip8_rollback(&child, &parent);
+    }
+    result->fork = (now_seconds() - start) * 1e9 / rollouts;
+
+    start = now_seconds();
+    for (uint64_t i = 0; i < rollouts; i++)
+    {
+        memcpy(&child, &parent, sizeof(struct Chip8));
+        handle_keypres(&child, i & 15, true);
+        chip8_run(&child, FORK_ROLLOUT, DEFAULT_IPS / 60);
+    }
+    result->copy_rollout = (now_seconds() - start) * 1e9 / rollouts;
+
+    chip8_fork(&child, &parent);
+    start = now_seconds();
+    for (uint64_t i = 0; i < rollouts; i++)
+    {
+        handle_keypres(&child, i & 15, true);
+        chip8_run(&child, FORK_ROLLOUT, DEFAULT_IPS / 60);
+        chip8_rollback(&child, &parent);
+    }
+    result->fork_rollout = (now_seconds() - start) * 1e9 / rollouts;
+}
+
+static void json_string(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (; *text != '\0'; text++)
+    {
+        if (*text == '"' || *text == '\\')
+        {
+            fprintf(file, "\\%c", *text);
+        }
+        else if ((unsigned char)*text < 0x20)
+        {
+            fprintf(file, "\\u%04x", *text);
+        }
+        else
+        {
+            fputc(*text, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// the number after option, 0 included. anything but a whole number is an error
+static bool number_option(const char *option, const char *text, uint64_t *value)
+{
+    if (!chip8_parse_number(text, 0, UINT64_MAX, value))
+    {
+        fprintf(stderr, "Error: bad value for %s %s\n", option, text);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t budget = DEFAULT_CYCLES;
+    uint64_t micro_budget = DEFAULT_MICRO_CYCLES;
+    uint64_t fork_rollouts = DEFAULT_FORK_ROLLOUTS;
+    const char *json_path = NULL;
+    int use_jit = 0;
+    int first_rom = argc;
+    static struct Chip8Cache cache;
+    struct Runner runner = {false, false, &cache, NULL};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], &budget))
+            {
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--micro-cycles") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], &micro_budget))
+            {
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--fork-rollouts") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], &fork_rollouts))
+            {
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--interp") == 0)
+        {
+            runner.interp = true;
+        }
+        else if (strcmp(argv[i], "--legacy") == 0)
+        {
+            runner.legacy = true;
+        }
+        else if (strcmp(argv[i], "--jit") == 0)
+        {
+            use_jit = 1;
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            first_rom = i;
+            break;
+        }
+    }
+
+    if (first_rom == argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct Chip8 rom;
+    struct Chip8 chip8;
+
+    if (use_jit)
+    {
+        runner.jit = chip8_jit_create();
+        if (runner.jit == NULL)
+        {
+            fprintf(stderr, "Error: no jit on this target\n");
+            return 1;
+        }
+    }
+
+    FILE *json = NULL;
+    if (json_path != NULL)
+    {
+        json = fopen(json_path, "w");
+        if (json == NULL)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(CHIP8_ERR_OPEN), json_path);
+            return 1;
+        }
+
+        fprintf(json, "{\n  \"backend\": \"%s\",\n  \"micro\": [",
+                runner.jit != NULL ? "jit" : runner.legacy ? "legacy" : runner.interp ? "interp" : "cached");
+    }
+
+    for (size_t i = 0; i < MICRO_BENCHES && micro_budget > 0; i++)
+    {
+        micro_program(&micro_benches[i], &chip8);
+
+        double start = now_seconds();
+        uint64_t cycles = run(&runner, &chip8, micro_budget);
+        double seconds = now_seconds() - start;
+
+        printf("%-24s cycles=%llu seconds=%.3f ns/op=%.2f\n",
+               micro_benches[i].name,
+               (unsigned long long)cycles,
+               seconds,
+               seconds * 1e9 / cycles);
+
+        if (json != NULL)
+        {
+            fprintf(json, "%s\n    {\"name\": ", i == 0 ? "" : ",");
+            json_string(json, micro_benches[i].name);
+            fprintf(json, ", \"cycles\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.3f}",
+                    (unsigned long long)cycles,
+                    seconds,
+                    seconds * 1e9 / cycles);
+        }
+    }
+
+    if (json != NULL)
+    {
+        fprintf(json, "\n  ],\n  \"roms\": [");
+    }
+
+    uint64_t total_cycles = 0;
+    double total_seconds = 0;
+
+    for (int i = first_rom; i < argc; i++)
+    {
+        initialize_chip8(&rom);
+        int error = load_program_to_memory(argv[i], &rom);
+        if (error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), argv[i]);
+            return 1;
+        }
+
+        uint64_t cycles = 0;
+        uint32_t restarts = 0;
+        double start = now_seconds();
+
+        while (cycles < budget)
+        {
+            chip8 = rom;
+            uint64_t ran = run(&runner, &chip8, budget - cycles);
+            restarts++;
+
+            // a rom that halts on its first instruction can't be measured
+            if (ran == 0)
+            {
+                break;
+            }
+            cycles += ran;
+        }
+
+        double seconds = now_seconds() - start;
+        total_cycles += cycles;
+        total_seconds += seconds;
+
+        printf("%-24s cycles=%llu restarts=%u seconds=%.3f ips=%.0f\n",
+               argv[i],
+               (unsigned long long)cycles,
+               restarts - 1,
+               seconds,
+               cycles / seconds);
+
+        if (json != NULL)
+        {
+            fprintf(json, "%s\n    {\"rom\": ", i == first_rom ? "" : ",");
+            json_string(json, argv[i]);
+            fprintf(json, ", \"cycles\": %llu, \"restarts\": %u, \"seconds\": %.6f, \"ips\": %.0f}",
+                    (unsigned long long)cycles,
+                    restarts - 1,
+                    seconds,
+                    cycles / seconds);
+        }
+    }
+
+    chip8_jit_destroy(runner.jit);
+
+    printf("%-24s cycles=%llu seconds=%.3f ips=%.0f\n",
+           "total",
+           (unsigned long long)total_cycles,
+           total_seconds,
+           total_cycles / total_seconds);
+
+    if (json != NULL)
+    {
+        fprintf(json, "\n  ],\n  \"total\": {\"cycles\": %llu, \"seconds\": %.6f, \"ips\": %.0f},\n  \"fork\": [",
+                (unsigned long long)total_cycles,
+                total_seconds,
+                total_cycles / total_seconds);
+    }
+
+    for (int i = first_rom; i < argc && fork_rollouts > 0; i++)
+    {
+        struct ForkBench result;
+
+        initialize_chip8(&rom);
+        load_program_to_memory(argv[i], &rom);
+        fork_bench(&rom, fork_rollouts, &result);
+
+        printf("%-24s rollouts=%llu copy=%zu bytes ns=%.1f fork+rollback ns=%.1f"
+               " with %d instructions copy ns=%.1f fork+rollback ns=%.1f\n",
+               argv[i],
+               (unsigned long long)fork_rollouts,
+               sizeof(struct Chip8),
+               result.copy,
+               result.fork,
+               FORK_ROLLOUT,
+               result.copy_rollout,
+               result.fork_rollout);
+
+        if (json != NULL)
+        {
+            fprintf(json, "%s\n    {\"rom\": ", i == first_rom ? "" : ",");
+            json_string(json, argv[i]);
+            fprintf(json, ", \"rollouts\": %llu, \"copy_bytes\": %zu, \"copy_ns\": %.3f, \"fork_ns\": %.3f, "
+                          "\"rollout_instructions\": %d, \"copy_rollout_ns\": %.3f, \"fork_rollout_ns\": %.3f}",
+                    (unsigned long long)fork_rollouts,
+                    sizeof(struct Chip8),
+                    result.copy,
+                    result.fork,
+                    FORK_ROLLOUT,
+                    result.copy_rollout,
+                    result.fork_rollout);
+        }
+    }
+
+    if (json != NULL)
+    {
+        fprintf(json, "\n  ]\n}\n");
+
+        if (ferror(json) != 0 || fclose(json) != 0)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(CHIP8_ERR_WRITE), json_path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,460 @@
+//
+//  chip8-corpus.c
+//  first c++ project
+//
+//  Rom archives. An archive is a header, an index sorted by SHA-1 and
+//  then the roms back to back. Opening one maps the file and reads the
+//  index once, after that every rom is a pointer into the mapping, so a
+//  batch job over thousands of roms makes a handful of syscalls in total
+//  instead of several per rom.
+//
+
+#include "chip8.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// "C8PK", the version and the entry count, all little endian like the
+// save states. each index entry is the SHA-1, the CRC-32, the offset and
+// size of the rom, its quirk profile and its name prefixed by its length
+static const uint8_t corpus_magic[4] = {'C', '8', 'P', 'K'};
+#define CORPUS_HEADER_SIZE (4 + 1 + 4)
+#define CORPUS_ENTRY_SIZE (CHIP8_SHA1_SIZE + 4 + 4 + 4 + 1 + 1)
+#define CORPUS_NAME_MAX 255
+
+static uint32_t rotate(uint32_t value, int bits)
+{
+    return value << bits | value >> (32 - bits);
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t block[64])
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++)
+    {
+        w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t next = rotate(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotate(b, 30);
+        b = a;
+        a = next;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void chip8_sha1(const uint8_t *data, size_t size, uint8_t digest[CHIP8_SHA1_SIZE])
+{
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t whole = size & ~(size_t)63;
+
+    for (size_t i = 0; i < whole; i += 64)
+    {
+        sha1_block(state, data + i);
+    }
+
+    // the tail, a one bit and the length in bits fill one or two more blocks
+    uint8_t last[128] = {0};
+    size_t rest = size - whole;
+    memcpy(last, data + whole, rest);
+    last[rest] = 0x80;
+    size_t blocks = rest < 56 ? 1 : 2;
+    uint64_t bits = (uint64_t)size * 8;
+    for (int i = 0; i < 8; i++)
+    {
+        last[blocks * 64 - 1 - i] = bits >> (i * 8);
+    }
+    for (size_t i = 0; i < blocks; i++)
+    {
+        sha1_block(state, last + i * 64);
+    }
+
+    for (int i = 0; i < 5; i++)
+    {
+        digest[i * 4] = state[i] >> 24;
+        digest[i * 4 + 1] = state[i] >> 16;
+        digest[i * 4 + 2] = state[i] >> 8;
+        digest[i * 4 + 3] = state[i];
+    }
+}
+
+// the zip / png CRC-32, a bit at a time. roms are a few KB and only
+// hashed when packing or identifying one
+uint32_t chip8_crc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t get32(const uint8_t *at)
+{
+    return at[0] | at[1] << 8 | at[2] << 16 | (uint32_t)at[3] << 24;
+}
+
+static void put32(FILE *file, uint32_t value)
+{
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+// walks the index twice, once to check it and size the names, once to
+// fill in the entries. the names are copied out so they can end in a nul.
+// lookups binary search the index, so it has to be in strictly ascending
+// SHA-1 order
+static int read_index(struct Chip8Corpus *corpus)
+{
+    const uint8_t *map = corpus->map;
+    size_t size = corpus->map_size;
+
+    if (size < CORPUS_HEADER_SIZE || memcmp(map, corpus_magic, sizeof(corpus_magic)) != 0 ||
+        map[4] != CHIP8_CORPUS_VERSION)
+    {
+        return CHIP8_ERR_BAD_CORPUS;
+    }
+
+    uint32_t count = get32(map + 5);
+    size_t names = 0;
+    size_t at = CORPUS_HEADER_SIZE;
+    const uint8_t *previous = NULL;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (size - at < CORPUS_ENTRY_SIZE)
+        {
+            return CHIP8_ERR_BAD_CORPUS;
+        }
+
+        const uint8_t *entry = map + at;
+        if (previous != NULL && memcmp(previous, entry, CHIP8_SHA1_SIZE) >= 0)
+        {
+            return CHIP8_ERR_BAD_CORPUS;
+        }
+        previous = entry;
+        uint32_t offset = get32(entry + CHIP8_SHA1_SIZE + 4);
+        uint32_t length = get32(entry + CHIP8_SHA1_SIZE + 8);
+        uint8_t quirks = entry[CHIP8_SHA1_SIZE + 12];
+        uint8_t name_length = entry[CHIP8_SHA1_SIZE + 13];
+        if (offset > size || length > size - offset || quirks >= CHIP8_QUIRKS_COUNT ||
+            size - at - CORPUS_ENTRY_SIZE < name_length)
+        {
+            return CHIP8_ERR_BAD_CORPUS;
+        }
+
+        names += name_length + 1;
+        at += CORPUS_ENTRY_SIZE + name_length;
+    }
+
+    // an empty archive is valid and has no entries to allocate
+    if (count == 0)
+    {
+        corpus->count = 0;
+        corpus->entries = NULL;
+        return CHIP8_OK;
+    }
+
+    struct Chip8CorpusEntry *entries = malloc(count * sizeof(struct Chip8CorpusEntry) + names);
+    if (entries == NULL)
+    {
+        return CHIP8_ERR_NO_MEMORY;
+    }
+
+    char *name = (char *)(entries + count);
+    at = CORPUS_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *entry = map + at;
+        uint8_t name_length = entry[CHIP8_SHA1_SIZE + 13];
+
+        memcpy(entries[i].sha1, entry, CHIP8_SHA1_SIZE);
+        entries[i].crc32 = get32(entry + CHIP8_SHA1_SIZE);
+        entries[i].data = map + get32(entry + CHIP8_SHA1_SIZE + 4);
+        entries[i].size = get32(entry + CHIP8_SHA1_SIZE + 8);
+        entries[i].quirks = entry[CHIP8_SHA1_SIZE + 12];
+        entries[i].name = name;
+        memcpy(name, entry + CORPUS_ENTRY_SIZE, name_length);
+        name[name_length] = '\0';
+
+        name += name_length + 1;
+        at += CORPUS_ENTRY_SIZE + name_length;
+    }
+
+    corpus->count = count;
+    corpus->entries = entries;
+    return CHIP8_OK;
+}
+
+int chip8_corpus_open(struct Chip8Corpus *corpus, const char *filename)
+{
+    memset(corpus, 0, sizeof(*corpus));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return CHIP8_ERR_OPEN;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return CHIP8_ERR_READ;
+    }
+    if (info.st_size < CORPUS_HEADER_SIZE)
+    {
+        close(fd);
+        return CHIP8_ERR_BAD_CORPUS;
+    }
+
+    // the mapping outlives the descriptor
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return CHIP8_ERR_READ;
+    }
+
+    corpus->map = map;
+    corpus->map_size = info.st_size;
+    int error = read_index(corpus);
+    if (error != CHIP8_OK)
+    {
+        chip8_corpus_close(corpus);
+    }
+    return error;
+}
+
+void chip8_corpus_close(struct Chip8Corpus *corpus)
+{
+    if (corpus->map != NULL)
+    {
+        munmap((void *)corpus->map, corpus->map_size);
+    }
+    free(corpus->entries);
+    memset(corpus, 0, sizeof(*corpus));
+}
+
+const struct Chip8CorpusEntry *chip8_corpus_find(const struct Chip8Corpus *corpus, const uint8_t sha1[CHIP8_SHA1_SIZE])
+{
+    uint32_t low = 0;
+    uint32_t high = corpus->count;
+
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        int order = memcmp(corpus->entries[middle].sha1, sha1, CHIP8_SHA1_SIZE);
+        if (order == 0)
+        {
+            return &corpus->entries[middle];
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return NULL;
+}
+
+// CRC-32 is what most rom lists go by. the index is in SHA-1 order, so
+// this one is a scan
+const struct Chip8CorpusEntry *chip8_corpus_find_crc(const struct Chip8Corpus *corpus, uint32_t crc32)
+{
+    for (uint32_t i = 0; i < corpus->count; i++)
+    {
+        if (corpus->entries[i].crc32 == crc32)
+        {
+            return &corpus->entries[i];
+        }
+    }
+    return NULL;
+}
+
+const struct Chip8CorpusEntry *chip8_corpus_lookup(const struct Chip8Corpus *corpus, const uint8_t *program, size_t size)
+{
+    uint8_t sha1[CHIP8_SHA1_SIZE];
+    chip8_sha1(program, size, sha1);
+    return chip8_corpus_find(corpus, sha1);
+}
+
+int chip8_corpus_load(const struct Chip8CorpusEntry *entry, struct Chip8 *chip8)
+{
+    int error = load_program_from_buffer(entry->data, entry->size, chip8);
+    if (error == CHIP8_OK)
+    {
+        chip8->quirks = entry->quirks;
+    }
+    return error;
+}
+
+int chip8_corpus_load_file(const struct Chip8Corpus *corpus, const char *filename, struct Chip8 *chip8)
+{
+    uint8_t program[CHIP8_PROGRAM_MAX];
+    size_t size;
+
+    int error = chip8_read_program(filename, program, &size);
+    if (error != CHIP8_OK)
+    {
+        return error;
+    }
+
+    error = load_program_from_buffer(program, size, chip8);
+    if (error == CHIP8_OK && corpus != NULL)
+    {
+        const struct Chip8CorpusEntry *entry = chip8_corpus_lookup(corpus, program, size);
+        if (entry != NULL)
+        {
+            chip8->quirks = entry->quirks;
+        }
+    }
+    return error;
+}
+
+static int compare_sha1(const struct Chip8CorpusEntry *a, const struct Chip8CorpusEntry *b)
+{
+    return memcmp(a->sha1, b->sha1, CHIP8_SHA1_SIZE);
+}
+
+// while sorting, crc32 holds the position the entry was given in
+static int compare_entries(const void *a, const void *b)
+{
+    const struct Chip8CorpusEntry *left = a;
+    const struct Chip8CorpusEntry *right = b;
+    int order = compare_sha1(left, right);
+    if (order != 0)
+    {
+        return order;
+    }
+    return left->crc32 < right->crc32 ? -1 : left->crc32 > right->crc32;
+}
+
+int chip8_corpus_write(const char *filename, struct Chip8CorpusEntry *entries, uint32_t *count)
+{
+    for (uint32_t i = 0; i < *count; i++)
+    {
+        chip8_sha1(entries[i].data, entries[i].size, entries[i].sha1);
+        entries[i].crc32 = i;
+    }
+
+    // a rom given more than once keeps the last name and profile it came with
+    qsort(entries, *count, sizeof(struct Chip8CorpusEntry), compare_entries);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < *count; i++)
+    {
+        if (unique != 0 && compare_sha1(&entries[unique - 1], &entries[i]) == 0)
+        {
+            unique--;
+        }
+        entries[unique++] = entries[i];
+    }
+    *count = unique;
+
+    for (uint32_t i = 0; i < unique; i++)
+    {
+        entries[i].crc32 = chip8_crc32(entries[i].data, entries[i].size);
+    }
+
+    uint64_t offset = CORPUS_HEADER_SIZE;
+    for (uint32_t i = 0; i < unique; i++)
+    {
+        size_t name_length = strlen(entries[i].name);
+        offset += CORPUS_ENTRY_SIZE + (name_length < CORPUS_NAME_MAX ? name_length : CORPUS_NAME_MAX);
+    }
+
+    uint64_t end = offset;
+    for (uint32_t i = 0; i < unique; i++)
+    {
+        end += entries[i].size;
+    }
+    if (end > UINT32_MAX)
+    {
+        return CHIP8_ERR_TOO_LARGE;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return CHIP8_ERR_OPEN;
+    }
+
+    fwrite(corpus_magic, 1, sizeof(corpus_magic), file);
+    fputc(CHIP8_CORPUS_VERSION, file);
+    put32(file, unique);
+
+    for (uint32_t i = 0; i < unique; i++)
+    {
+        size_t name_length = strlen(entries[i].name);
+        if (name_length > CORPUS_NAME_MAX)
+        {
+            name_length = CORPUS_NAME_MAX;
+        }
+
+        fwrite(entries[i].sha1, 1, CHIP8_SHA1_SIZE, file);
+        put32(file, entries[i].crc32);
+        put32(file, offset);
+        put32(file, entries[i].size);
+        fputc(entries[i].quirks, file);
+        fputc(name_length, file);
+        fwrite(entries[i].name, 1, name_length, file);
+        offset += entries[i].size;
+    }
+
+    for (uint32_t i = 0; i < unique; i++)
+    {
+        fwrite(entries[i].data, 1, entries[i].size, file);
+    }
+
+    bool failed = ferror(file) != 0;
+    failed |= fclose(file) != 0;
+    return failed ? CHIP8_ERR_WRITE : CHIP8_OK;
+}
@@ -0,0 +1,658 @@
+//
+//  chip8-jit.c
+//  first c++ project
+//
+//  x86-64 dynamic recompiler. Straight runs of simple instructions are
+//  translated into native code once and then called directly; anything
+//  the translator doesn't know goes through execute_opcode instead.
+//
+
+#include "chip8.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_BLOCK_MAX 32
+#define JIT_BLOCKS 4096
+#define JIT_CODE_SIZE (1 << 20)
+// longest native sequence a single instruction can emit, with its limit
+// check and exit stub
+#define JIT_OP_MAX 96
+
+// runs at most limit instructions of the block, limit is at least 1.
+// returns how many ran
+typedef uint32_t (*jit_code)(struct Chip8 *chip8, uint32_t limit);
+
+struct JitBlock
+{
+    uint16_t pc;
+    uint8_t count; // 0 when the first instruction has to be interpreted
+    bool stale;    // a page it was translated from has been written since
+    uint64_t pages;
+    jit_code code;
+    uint8_t source[JIT_BLOCK_MAX * 2 + 2]; // the bytes it was translated from, and the word after
+};
+
+struct Chip8Jit
+{
+    uint16_t block_at[CHIP8_MEMORY_SIZE]; // index + 1 into blocks, 0 when not translated
+    uint16_t count;
+    struct JitBlock blocks[JIT_BLOCKS];
+    uint8_t *code;
+    size_t code_used;
+    size_t page_size;
+    uint8_t quirks; // the profile the blocks were translated for
+};
+
+// the translated code gets the machine in rdi and addresses every field
+// off it, so these are the only layout facts the emitter needs
+#define OFF_V(x) (offsetof(struct Chip8, v_register) + (x))
+#define OFF_I offsetof(struct Chip8, I)
+#define OFF_PC offsetof(struct Chip8, pc)
+#define OFF_DT offsetof(struct Chip8, delay_timer)
+#define OFF_ST offsetof(struct Chip8, sound_timer)
+
+// modrm bytes for [rdi + disp32] with each register in the reg field
+#define RDI_AL 0x87
+#define RDI_CL 0x8F
+#define RDI_DL 0x97
+
+struct Emitter
+{
+    uint8_t *at;
+};
+
+static void emit8(struct Emitter *e, uint8_t byte)
+{
+    *e->at++ = byte;
+}
+
+static void emit16(struct Emitter *e, uint16_t value)
+{
+    memcpy(e->at, &value, 2);
+    e->at += 2;
+}
+
+static void emit32(struct Emitter *e, uint32_t value)
+{
+    memcpy(e->at, &value, 4);
+    e->at += 4;
+}
+
+// movzx reg, byte [rdi + disp]
+static void emit_load(struct Emitter *e, uint8_t modrm, uint32_t disp)
+{
+    emit8(e, 0x0F); // movzx
+    emit8(e, 0xB6);
+    emit8(e, modrm);
+    emit32(e, disp);
+}
+
+// mov byte [rdi + disp], reg
+static void emit_store(struct Emitter *e, uint8_t modrm, uint32_t disp)
+{
+    emit8(e, 0x88);
+    emit8(e, modrm);
+    emit32(e, disp);
+}
+
+static void emit_store_imm(struct Emitter *e, uint32_t disp, uint8_t value)
+{
+    emit8(e, 0xC6);
+    emit8(e, 0x87);
+    emit32(e, disp);
+    emit8(e, value);
+}
+
+static void emit_store_pc(struct Emitter *e, uint16_t pc)
+{
+    emit8(e, 0x66); // mov word [rdi + pc], imm16
+    emit8(e, 0xC7);
+    emit8(e, 0x87);
+    emit32(e, OFF_PC);
+    emit16(e, pc);
+}
+
+// pc = condition ? skip : next, with the condition already in the flags
+static void emit_skip(struct Emitter *e, uint8_t cmov, uint16_t next)
+{
+    emit8(e, 0xB8); // mov eax, next
+    emit32(e, next);
+    emit8(e, 0xB9); // mov ecx, next + 2
+    emit32(e, next + 2);
+    emit8(e, 0x0F); // cmovcc eax, ecx
+    emit8(e, cmov);
+    emit8(e, 0xC1);
+    emit8(e, 0x66); // mov word [rdi + pc], ax
+    emit8(e, 0x89);
+    emit8(e, RDI_AL);
+    emit32(e, OFF_PC);
+}
+
+#define CMOVE 0x44
+#define CMOVNE 0x45
+
+// emits one instruction, mirroring the interpreter handler for the
+// machine's quirk profile exactly, including the order VF is written in.
+// following is the opcode after it, which decides how far a skip goes.
+// returns false when the instruction has to go through the interpreter,
+// and sets *ends when it leaves straight line code
+static bool emit_op(struct Emitter *e, const struct Chip8Quirks *quirks, uint16_t opcode, uint16_t following,
+                    uint16_t pc, bool *ends)
+{
+    unsigned x = (opcode >> 8) & 0x000F;
+    unsigned y = (opcode >> 4) & 0x000F;
+    uint8_t nn = opcode & 0x00FF;
+
+    *ends = false;
+
+    switch (opcode & 0xF000)
+    {
+    case 0x1000:
+        emit_store_pc(e, opcode & 0x0FFF);
+        *ends = true;
+        return true;
+    case 0x3000:
+    case 0x4000:
+        // skipping over an XO-CHIP F000 NNNN is left to the interpreter
+        if (following == 0xF000)
+        {
+            return false;
+        }
+        emit8(e, 0x80); // cmp byte [rdi + vx], nn
+        emit8(e, 0xBF);
+        emit32(e, OFF_V(x));
+        emit8(e, nn);
+        emit_skip(e, (opcode & 0xF000) == 0x3000 ? CMOVE : CMOVNE, pc + 2);
+        *ends = true;
+        return true;
+    case 0x5000:
+    case 0x9000:
+        if (following == 0xF000)
+        {
+            return false;
+        }
+        emit_load(e, RDI_AL, OFF_V(x));
+        emit8(e, 0x3A); // cmp al, byte [rdi + vy]
+        emit8(e, RDI_AL);
+        emit32(e, OFF_V(y));
+        emit_skip(e, (opcode & 0xF000) == 0x5000 ? CMOVE : CMOVNE, pc + 2);
+        *ends = true;
+        return true;
+    case 0x6000:
+        emit_store_imm(e, OFF_V(x), nn);
+        return true;
+    case 0x7000:
+        emit8(e, 0x80); // add byte [rdi + vx], nn
+        emit8(e, 0x87);
+        emit32(e, OFF_V(x));
+        emit8(e, nn);
+        return true;
+    case 0x8000:
+        switch (opcode & 0x000F)
+        {
+        case 0x0:
+            emit_load(e, RDI_AL, OFF_V(y));
+            emit_store(e, RDI_AL, OFF_V(x));
+            return true;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        {
+            static const uint8_t alu[] = {0, 0x08, 0x20, 0x30}; // or, and, xor
+            emit_load(e, RDI_AL, OFF_V(x));
+            emit_load(e, RDI_CL, OFF_V(y));
+            emit8(e, alu[opcode & 0x000F]); // <op> al, cl
+            emit8(e, 0xC8);
+            emit_store(e, RDI_AL, OFF_V(x));
+            if (quirks->vf_reset)
+            {
+                emit_store_imm(e, OFF_V(0xF), 0);
+            }
+            return true;
+        }
+        case 0x4:
+            emit_load(e, RDI_AL, OFF_V(x));
+            emit_load(e, RDI_CL, OFF_V(y));
+            emit8(e, 0x00); // add al, cl
+            emit8(e, 0xC8);
+            emit8(e, 0x0F); // setc dl
+            emit8(e, 0x92);
+            emit8(e, 0xC2);
+            emit_store(e, RDI_AL, OFF_V(x));
+            emit_store(e, RDI_DL, OFF_V(0xF));
+            return true;
+        case 0x5:
+        case 0x7:
+        {
+            // VF = no borrow
+            unsigned minuend = (opcode & 0x000F) == 0x5 ? x : y;
+            unsigned subtrahend = (opcode & 0x000F) == 0x5 ? y : x;
+            emit_load(e, RDI_AL, OFF_V(minuend));
+            emit_load(e, RDI_CL, OFF_V(subtrahend));
+            emit8(e, 0x38); // cmp al, cl
+            emit8(e, 0xC8);
+            emit8(e, 0x0F); // setae dl
+            emit8(e, 0x93);
+            emit8(e, 0xC2);
+            emit8(e, 0x28); // sub al, cl
+            emit8(e, 0xC8);
+            emit_store(e, RDI_AL, OFF_V(x));
+            emit_store(e, RDI_DL, OFF_V(0xF));
+            return true;
+        }
+        case 0x6:
+            emit_load(e, RDI_AL, OFF_V(quirks->shift_vy ? y : x));
+            emit8(e, 0x88); // mov dl, al
+            emit8(e, 0xC2);
+            emit8(e, 0x80); // and dl, 1
+            emit8(e, 0xE2);
+            emit8(e, 0x01);
+            emit8(e, 0xD0); // shr al, 1
+            emit8(e, 0xE8);
+            emit_store(e, RDI_AL, OFF_V(x));
+            emit_store(e, RDI_DL, OFF_V(0xF));
+            return true;
+        case 0xE:
+            emit_load(e, RDI_AL, OFF_V(quirks->shift_vy ? y : x));
+            emit8(e, 0x88); // mov dl, al
+            emit8(e, 0xC2);
+            emit8(e, 0xC0); // shr dl, 7
+            emit8(e, 0xEA);
+            emit8(e, 0x07);
+            emit8(e, 0xD0); // shl al, 1
+            emit8(e, 0xE0);
+            emit_store(e, RDI_AL, OFF_V(x));
+            emit_store(e, RDI_DL, OFF_V(0xF));
+            return true;
+        default:
+            return false;
+        }
+    case 0xA000:
+        emit8(e, 0x66); // mov word [rdi + I], nnn
+        emit8(e, 0xC7);
+        emit8(e, 0x87);
+        emit32(e, OFF_I);
+        emit16(e, opcode & 0x0FFF);
+        return true;
+    case 0xF000:
+        switch (nn)
+        {
+        case 0x07:
+            emit_load(e, RDI_AL, OFF_DT);
+            emit_store(e, RDI_AL, OFF_V(x));
+            return true;
+        case 0x15:
+            emit_load(e, RDI_AL, OFF_V(x));
+            emit_store(e, RDI_AL, OFF_DT);
+            return true;
+        case 0x18:
+            emit_load(e, RDI_AL, OFF_V(x));
+            emit_store(e, RDI_AL, OFF_ST);
+            return true;
+        case 0x1E:
+            emit_load(e, RDI_AL, OFF_V(x));
+            emit8(e, 0x66); // add word [rdi + I], ax
+            emit8(e, 0x01);
+            emit8(e, RDI_AL);
+            emit32(e, OFF_I);
+            return true;
+        case 0x29:
+            emit_load(e, RDI_AL, OFF_V(x));
+            emit8(e, 0x83); // and eax, 0xF
+            emit8(e, 0xE0);
+            emit8(e, 0x0F);
+            emit8(e, 0x8D); // lea eax, [rax + rax * 4 + FONTSET_START]
+            emit8(e, 0x84);
+            emit8(e, 0x80);
+            emit32(e, FONTSET_START);
+            emit8(e, 0x66); // mov word [rdi + I], ax
+            emit8(e, 0x89);
+            emit8(e, RDI_AL);
+            emit32(e, OFF_I);
+            return true;
+        default:
+            return false;
+        }
+    default:
+        return false;
+    }
+}
+
+struct Chip8Jit *chip8_jit_create(void)
+{
+    struct Chip8Jit *jit = malloc(sizeof(struct Chip8Jit));
+    if (jit == NULL)
+    {
+        return NULL;
+    }
+
+    // written with the pages read write, flipped to read execute before
+    // anything runs, so the buffer is never writable and executable at once
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        free(jit);
+        return NULL;
+    }
+
+    jit->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    chip8_jit_reset(jit);
+    return jit;
+}
+
+void chip8_jit_destroy(struct Chip8Jit *jit)
+{
+    if (jit != NULL)
+    {
+        munmap(jit->code, JIT_CODE_SIZE);
+        free(jit);
+    }
+}
+
+void chip8_jit_reset(struct Chip8Jit *jit)
+{
+    memset(jit->block_at, 0, sizeof(jit->block_at));
+    jit->count = 0;
+    jit->code_used = 0;
+    jit->quirks = CHIP8_QUIRKS_DEFAULT;
+}
+
+static void flush_blocks(struct Chip8Jit *jit)
+{
+    for (uint16_t i = 0; i < jit->count; i++)
+    {
+        jit->block_at[jit->blocks[i].pc] = 0;
+    }
+    jit->count = 0;
+    jit->code_used = 0;
+}
+
+// translating costs two mprotect calls, so blocks on written pages are
+// only marked stale and get compared against memory before they run again.
+// a machine copied in from the same rom reuses all of its code that way
+static void invalidate_written(struct Chip8 *chip8, struct Chip8Jit *jit)
+{
+    uint64_t written = chip8->written_pages;
+    chip8->written_pages = 0;
+
+    for (uint16_t i = 0; i < jit->count; i++)
+    {
+        if ((jit->blocks[i].pages & written) != 0)
+        {
+            jit->blocks[i].stale = true;
+        }
+    }
+}
+
+// mov word [rdi + pc], next; mov eax, ran; ret
+static void emit_exit(struct Emitter *e, uint16_t next, uint32_t ran)
+{
+    emit_store_pc(e, next);
+    emit8(e, 0xB8);
+    emit32(e, ran);
+    emit8(e, 0xC3);
+}
+
+// a forked child reads some of its pages from its parent, so a block's
+// source is copied and compared a page at a time. blocks stop short of the
+// end of memory, so it never wraps
+static const uint8_t *source_at(const struct Chip8 *chip8, const struct JitBlock *block, uint32_t done)
+{
+    uint32_t address = block->pc + done;
+    return chip8_memory_page(chip8, address) + (address & (CHIP8_FORK_PAGE_SIZE - 1));
+}
+
+static uint32_t source_chunk(const struct JitBlock *block, uint32_t done)
+{
+    uint32_t left = block->count * 2 + 2u - done;
+    uint32_t room = CHIP8_FORK_PAGE_SIZE - ((block->pc + done) & (CHIP8_FORK_PAGE_SIZE - 1));
+    return left < room ? left : room;
+}
+
+// translates from the current pc into a fresh slot, or back into the slot
+// of a stale block for the same pc
+static struct JitBlock *translate(struct Chip8 *chip8, struct Chip8Jit *jit, struct JitBlock *block)
+{
+    if (jit->count == JIT_BLOCKS || JIT_CODE_SIZE - jit->code_used < JIT_BLOCK_MAX * JIT_OP_MAX)
+    {
+        flush_blocks(jit);
+        block = NULL;
+    }
+
+    if (block == NULL)
+    {
+        block = &jit->blocks[jit->count++];
+    }
+
+    uint16_t pc = chip8->pc;
+    bool ends = false;
+
+    // emitted into a scratch buffer first, the code has no absolute
+    // addresses so it can be copied anywhere
+    uint8_t scratch[JIT_BLOCK_MAX * JIT_OP_MAX];
+    struct Emitter e = {scratch};
+    uint8_t *limit_jumps[JIT_BLOCK_MAX];
+
+    block->pc = pc;
+    block->count = 0;
+    block->stale = false;
+
+    // a parking instruction is left to the interpreter so the run stops
+    // right where chip8_run would see the halt
+    while (!ends && block->count < JIT_BLOCK_MAX && pc < sizeof(chip8->memory) - 3)
+    {
+        uint16_t opcode = chip8_peek(chip8, pc) << 8 | chip8_peek(chip8, pc + 1);
+        if (chip8_parks(opcode, pc))
+        {
+            break;
+        }
+
+        uint16_t following = chip8_peek(chip8, pc + 2) << 8 | chip8_peek(chip8, pc + 3);
+        if (!emit_op(&e, chip8_quirks(jit->quirks), opcode, following, pc, &ends))
+        {
+            break;
+        }
+
+        block->count++;
+        pc += 2;
+
+        // leave early once the caller's limit is used up, so a block
+        // never runs past a timer tick or the end of the budget
+        if (!ends)
+        {
+            emit8(&e, 0xFF); // dec esi
+            emit8(&e, 0xCE);
+            emit8(&e, 0x0F); // jz exit stub, patched below
+            emit8(&e, 0x84);
+            limit_jumps[block->count - 1] = e.at;
+            emit32(&e, 0);
+        }
+    }
+
+    block->code = NULL;
+    if (block->count > 0)
+    {
+        if (ends)
+        {
+            emit8(&e, 0xB8); // mov eax, count
+            emit32(&e, block->count);
+            emit8(&e, 0xC3);
+        }
+        else
+        {
+            // the last limit check would land on the same exit as falling through
+            e.at -= 8;
+            emit_exit(&e, pc, block->count);
+        }
+
+        for (uint32_t i = 0; i + 1 < block->count; i++)
+        {
+            int32_t rel = (int32_t)(e.at - (limit_jumps[i] + 4));
+            memcpy(limit_jumps[i], &rel, 4);
+            emit_exit(&e, block->pc + 2 * (i + 1), i + 1);
+        }
+
+        // only the pages the new code lands on change protection, a few
+        // hundred bytes of code don't need the whole region's TLB entries flushed
+        size_t size = e.at - scratch;
+        size_t first = jit->code_used & ~(jit->page_size - 1);
+        size_t end = (jit->code_used + size + jit->page_size - 1) & ~(jit->page_size - 1);
+        mprotect(jit->code + first, end - first, PROT_READ | PROT_WRITE);
+        memcpy(jit->code + jit->code_used, scratch, size);
+        mprotect(jit->code + first, end - first, PROT_READ | PROT_EXEC);
+
+        block->code = (jit_code)(jit->code + jit->code_used);
+        jit->code_used += size;
+        for (uint32_t done = 0, chunk; done < block->count * 2 + 2u; done += chunk)
+        {
+            chunk = source_chunk(block, done);
+            memcpy(&block->source[done], source_at(chip8, block, done), chunk);
+        }
+    }
+
+    // a block depends on the word after its last instruction too, a skip
+    // there was translated for it and a halt block stopped at it
+    uint32_t last = pc + 1u;
+    block->pages = 0;
+    for (uint32_t page = block->pc >> CHIP8_PAGE_SHIFT; page <= last >> CHIP8_PAGE_SHIFT; page++)
+    {
+        block->pages |= 1ULL << (page & 63);
+    }
+
+    jit->block_at[block->pc] = block - jit->blocks + 1;
+    return block;
+}
+
+// whether memory still holds what the block was translated from
+static bool same_source(const struct Chip8 *chip8, const struct JitBlock *block)
+{
+    for (uint32_t done = 0, chunk; done < block->count * 2 + 2u; done += chunk)
+    {
+        chunk = source_chunk(block, done);
+        if (memcmp(&block->source[done], source_at(chip8, block, done), chunk) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct JitBlock *lookup(struct Chip8 *chip8, struct Chip8Jit *jit)
+{
+    uint16_t index = jit->block_at[chip8->pc];
+    if (index == 0)
+    {
+        return translate(chip8, jit, NULL);
+    }
+
+    struct JitBlock *block = &jit->blocks[index - 1];
+    if (block->stale)
+    {
+        // empty blocks are cheap to redo, they never emitted anything
+        if (block->count == 0 || !same_source(chip8, block))
+        {
+            return translate(chip8, jit, block);
+        }
+        block->stale = false;
+    }
+
+    return block;
+}
+
+uint64_t chip8_run_jit(struct Chip8 *chip8, struct Chip8Jit *jit, uint64_t max_cycles, uint32_t cycles_per_tick)
+{
+    uint64_t cycles = 0;
+    uint32_t until_tick = cycles_per_tick;
+
+    // code translated for another profile is no use to this machine
+    if (chip8->quirks != jit->quirks)
+    {
+        flush_blocks(jit);
+        jit->quirks = chip8->quirks;
+    }
+
+    while (cycles < max_cycles)
+    {
+        if (chip8->written_pages != 0)
+        {
+            invalidate_written(chip8, jit);
+        }
+
+        struct JitBlock *block = NULL;
+        if (chip8->pc < sizeof(chip8->memory) - 1)
+        {
+            block = lookup(chip8, jit);
+        }
+
+        uint32_t ran;
+
+        if (block != NULL && block->count > 0)
+        {
+            uint32_t limit = block->count;
+            if (limit > max_cycles - cycles)
+            {
+                limit = max_cycles - cycles;
+            }
+            if (cycles_per_tick != 0 && limit > until_tick)
+            {
+                limit = until_tick;
+            }
+
+            ran = block->code(chip8, limit);
+        }
+        else
+        {
+            ran = chip8_run(chip8, 1, 0);
+            if (ran == 0)
+            {
+                break;
+            }
+        }
+
+        cycles += ran;
+
+        if (cycles_per_tick != 0 && (until_tick -= ran) == 0)
+        {
+            chip8_tick_timers(chip8);
+            until_tick = cycles_per_tick;
+        }
+    }
+
+    return cycles;
+}
+
+#else
+
+// no native backend on this target, callers fall back to the interpreter
+
+struct Chip8Jit
+{
+    int unused;
+};
+
+struct Chip8Jit *chip8_jit_create(void)
+{
+    return NULL;
+}
+
+void chip8_jit_destroy(struct Chip8Jit *jit)
+{
+}
+
+void chip8_jit_reset(struct Chip8Jit *jit)
+{
+}
+
+uint64_t chip8_run_jit(struct Chip8 *chip8, struct Chip8Jit *jit, uint64_t max_cycles, uint32_t cycles_per_tick)
+{
+    return chip8_run(chip8, max_cycles, cycles_per_tick);
+}
+
+#endif
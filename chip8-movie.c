@@ -0,0 +1,196 @@
+//
+//  chip8-movie.c
+//  first c++ project
+//
+//  Movie files. A recording starts with a save state of the machine and
+//  then lists every key change, timer tick and restored state together
+//  with the cycle it happened on, so the headless core can play a
+//  frontend session back exactly.
+//
+
+#include "chip8.h"
+
+#include <string.h>
+
+// each event is a varint of the cycles since the previous event shifted
+// left by 6, with the event code in the low bits
+#define MOVIE_EVENT_BITS 6
+
+static const uint8_t movie_magic[4] = {'C', '8', 'M', 'V'};
+
+static void put_varint(FILE *file, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        fputc((value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc(value, file);
+}
+
+// false at the end of the file or when it ends halfway through a value
+static bool get_varint(FILE *file, uint64_t *value, bool *truncated)
+{
+    *value = 0;
+    *truncated = false;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(file);
+        if (byte == EOF)
+        {
+            *truncated = shift != 0;
+            return false;
+        }
+
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    *truncated = true;
+    return false;
+}
+
+static void put_event(struct Chip8Recorder *recorder, uint64_t cycle, int event)
+{
+    put_varint(recorder->file, (cycle - recorder->cycle) << MOVIE_EVENT_BITS | event);
+    recorder->cycle = cycle;
+}
+
+static void put_state(struct Chip8Recorder *recorder, const struct Chip8 *chip8)
+{
+    uint8_t state[CHIP8_STATE_SIZE];
+    chip8_save_state(chip8, state, sizeof(state));
+    fwrite(state, 1, sizeof(state), recorder->file);
+}
+
+int chip8_record_start(struct Chip8Recorder *recorder, const char *filename, const struct Chip8 *chip8)
+{
+    recorder->file = fopen(filename, "wb");
+    if (recorder->file == NULL)
+    {
+        return CHIP8_ERR_OPEN;
+    }
+
+    recorder->cycle = 0;
+    fwrite(movie_magic, 1, sizeof(movie_magic), recorder->file);
+    fputc(CHIP8_MOVIE_VERSION, recorder->file);
+    put_state(recorder, chip8);
+    return CHIP8_OK;
+}
+
+void chip8_record_key(struct Chip8Recorder *recorder, uint64_t cycle, int index, bool pressed)
+{
+    put_event(recorder, cycle, (pressed ? CHIP8_MOVIE_KEY_DOWN : CHIP8_MOVIE_KEY_UP) + (index & 15));
+}
+
+void chip8_record_tick(struct Chip8Recorder *recorder, uint64_t cycle)
+{
+    put_event(recorder, cycle, CHIP8_MOVIE_TICK);
+}
+
+void chip8_record_state(struct Chip8Recorder *recorder, uint64_t cycle, const struct Chip8 *chip8)
+{
+    put_event(recorder, cycle, CHIP8_MOVIE_STATE);
+    put_state(recorder, chip8);
+}
+
+int chip8_record_stop(struct Chip8Recorder *recorder, uint64_t cycle)
+{
+    put_event(recorder, cycle, CHIP8_MOVIE_END);
+
+    bool failed = ferror(recorder->file) != 0;
+    failed |= fclose(recorder->file) != 0;
+    recorder->file = NULL;
+    return failed ? CHIP8_ERR_WRITE : CHIP8_OK;
+}
+
+static int replay_state(FILE *file, struct Chip8 *chip8)
+{
+    uint8_t state[CHIP8_STATE_SIZE];
+    if (fread(state, 1, sizeof(state), file) != sizeof(state))
+    {
+        return CHIP8_ERR_BAD_MOVIE;
+    }
+    return chip8_load_state(chip8, state, sizeof(state)) == CHIP8_OK ? CHIP8_OK : CHIP8_ERR_BAD_MOVIE;
+}
+
+static int replay_events(FILE *file, struct Chip8 *chip8, uint64_t *cycles)
+{
+    uint8_t header[sizeof(movie_magic) + 1];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, movie_magic, sizeof(movie_magic)) != 0 ||
+        header[sizeof(movie_magic)] != CHIP8_MOVIE_VERSION)
+    {
+        return CHIP8_ERR_BAD_MOVIE;
+    }
+
+    initialize_chip8(chip8);
+    if (replay_state(file, chip8) != CHIP8_OK)
+    {
+        return CHIP8_ERR_BAD_MOVIE;
+    }
+
+    for (;;)
+    {
+        uint64_t value;
+        bool truncated;
+        if (!get_varint(file, &value, &truncated))
+        {
+            // a recording cut short by a crash still plays up to its last event
+            return truncated ? CHIP8_ERR_BAD_MOVIE : CHIP8_OK;
+        }
+
+        // a parked cpu spins on its self-jump without changing anything,
+        // so stopping early there still ends in the recorded state
+        uint64_t until = value >> MOVIE_EVENT_BITS;
+        chip8_run(chip8, until, 0);
+        *cycles += until;
+
+        int event = value & ((1 << MOVIE_EVENT_BITS) - 1);
+        if (event < CHIP8_MOVIE_KEY_DOWN)
+        {
+            handle_keypres(chip8, event - CHIP8_MOVIE_KEY_UP, false);
+        }
+        else if (event < CHIP8_MOVIE_TICK)
+        {
+            handle_keypres(chip8, event - CHIP8_MOVIE_KEY_DOWN, true);
+        }
+        else if (event == CHIP8_MOVIE_TICK)
+        {
+            chip8_tick_timers(chip8);
+        }
+        else if (event == CHIP8_MOVIE_STATE)
+        {
+            if (replay_state(file, chip8) != CHIP8_OK)
+            {
+                return CHIP8_ERR_BAD_MOVIE;
+            }
+        }
+        else if (event == CHIP8_MOVIE_END)
+        {
+            return CHIP8_OK;
+        }
+        else
+        {
+            return CHIP8_ERR_BAD_MOVIE;
+        }
+    }
+}
+
+int chip8_replay(const char *filename, struct Chip8 *chip8, uint64_t *cycles)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return CHIP8_ERR_OPEN;
+    }
+
+    *cycles = 0;
+    int error = replay_events(file, chip8, cycles);
+    fclose(file);
+    return error;
+}
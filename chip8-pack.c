@@ -0,0 +1,142 @@
+//
+//  chip8-pack.c
+//  first c++ project
+//
+//  Packs rom files into an archive for the corpus loader, or lists what
+//  an archive holds. Each rom is stored under its file name together with
+//  the quirk profile it should run with.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+void usage(const char *program)
+{
+    printf("usage: %s archive [--quirks P] rom... [--quirks P] rom...\n", program);
+    printf("       %s --list archive\n", program);
+    printf("  --quirks P  the roms after it run as xochip (default), vip, chip48 or schip\n");
+    printf("  --list F    print the index of an archive\n");
+}
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static int list(const char *filename)
+{
+    struct Chip8Corpus corpus;
+    int error = chip8_corpus_open(&corpus, filename);
+    if (error != CHIP8_OK)
+    {
+        fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), filename);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < corpus.count; i++)
+    {
+        const struct Chip8CorpusEntry *entry = &corpus.entries[i];
+        for (int j = 0; j < CHIP8_SHA1_SIZE; j++)
+        {
+            printf("%02x", entry->sha1[j]);
+        }
+        printf(" %08x %6u %-6s %s\n", entry->crc32, entry->size, chip8_quirks(entry->quirks)->name, entry->name);
+    }
+
+    printf("total: roms=%u bytes=%zu\n", corpus.count, corpus.map_size);
+    chip8_corpus_close(&corpus);
+    return 0;
+}
+
+static void free_programs(uint8_t **programs, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        free(programs[i]);
+    }
+    free(programs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "--list") == 0)
+    {
+        return list(argv[2]);
+    }
+    if (argc < 3 || argv[1][0] == '-')
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // writing drops repeated roms from entries, so the buffers are freed
+    // through programs instead
+    const char *archive = argv[1];
+    struct Chip8CorpusEntry *entries = malloc((argc - 2) * sizeof(struct Chip8CorpusEntry));
+    uint8_t **programs = malloc((argc - 2) * sizeof(uint8_t *));
+    if (entries == NULL || programs == NULL)
+    {
+        fprintf(stderr, "Error: %s\n", chip8_strerror(CHIP8_ERR_NO_MEMORY));
+        return 1;
+    }
+    uint32_t count = 0;
+    int quirks = CHIP8_QUIRKS_DEFAULT;
+    int failed = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc)
+        {
+            quirks = chip8_quirks_from_name(argv[++i]);
+            if (quirks == CHIP8_QUIRKS_COUNT)
+            {
+                fprintf(stderr, "Error: unknown quirk profile %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        uint8_t *program = malloc(CHIP8_PROGRAM_MAX);
+        if (program == NULL)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(CHIP8_ERR_NO_MEMORY), argv[i]);
+            free_programs(programs, count);
+            return 1;
+        }
+
+        size_t size;
+        int error = chip8_read_program(argv[i], program, &size);
+        if (error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), argv[i]);
+            free(program);
+            failed++;
+            continue;
+        }
+
+        programs[count] = program;
+        entries[count].name = base_name(argv[i]);
+        entries[count].data = program;
+        entries[count].size = size;
+        entries[count].quirks = quirks;
+        count++;
+    }
+
+    uint32_t read = count;
+    int error = chip8_corpus_write(archive, entries, &count);
+    free_programs(programs, read);
+    free(entries);
+    if (error != CHIP8_OK)
+    {
+        fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), archive);
+        return 1;
+    }
+
+    printf("total: roms=%u repeated=%u failed=%d\n", count, read - count, failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,437 @@
+//
+//  chip8-par.c
+//  first c++ project
+//
+//  Parallel headless runner: every (rom, seed) pair becomes an independent
+//  struct Chip8 instance, and chip8_pool_run spreads the instances over
+//  worker threads that steal work from each other when they run dry.
+//  Rom archives made with chip8-pack run every rom they hold, each with
+//  its own quirk profile, and every movie recorded with main --record is
+//  played back as one more instance.
+//
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "chip8.h"
+
+#define DEFAULT_CYCLES 10000000
+#define DEFAULT_IPS 700
+
+static bool has_extension(const char *name, const char *extension)
+{
+    size_t len = strlen(name);
+    size_t extension_len = strlen(extension);
+    return len > extension_len && strcmp(name + len - extension_len, extension) == 0;
+}
+
+static bool has_input_extension(const char *name)
+{
+    return has_extension(name, ".ch8") || has_extension(name, ".c8pk") || has_extension(name, ".c8mv");
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool add_path(char ***paths, int *total, int *capacity, char *path)
+{
+    if (path == NULL)
+    {
+        return false;
+    }
+    if (*total == *capacity)
+    {
+        char **grown = realloc(*paths, *capacity * 2 * sizeof(char *));
+        if (grown == NULL)
+        {
+            free(path);
+            return false;
+        }
+        *paths = grown;
+        *capacity *= 2;
+    }
+    (*paths)[(*total)++] = path;
+    return true;
+}
+
+// expands directories into the .ch8 files, archives and movies they
+// contain, sorted by name. -1 when memory runs out
+static int collect_inputs(char **args, int count, char ***paths)
+{
+    int capacity = 64;
+    int total = 0;
+    *paths = malloc(capacity * sizeof(char *));
+    if (*paths == NULL)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat info;
+        if (stat(args[i], &info) != 0)
+        {
+            fprintf(stderr, "Error: Couldn't open file %s\n", args[i]);
+            continue;
+        }
+
+        if (!S_ISDIR(info.st_mode))
+        {
+            if (!add_path(paths, &total, &capacity, strdup(args[i])))
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        DIR *dir = opendir(args[i]);
+        if (dir == NULL)
+        {
+            fprintf(stderr, "Error: Couldn't open directory %s\n", args[i]);
+            continue;
+        }
+
+        int first = total;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (!has_input_extension(entry->d_name))
+            {
+                continue;
+            }
+
+            size_t dir_len = strlen(args[i]);
+            const char *separator = args[i][dir_len - 1] == '/' ? "" : "/";
+            size_t len = dir_len + strlen(entry->d_name) + 2;
+            char *path = malloc(len);
+            if (path != NULL)
+            {
+                snprintf(path, len, "%s%s%s", args[i], separator, entry->d_name);
+            }
+            if (!add_path(paths, &total, &capacity, path))
+            {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+
+        qsort(*paths + first, total - first, sizeof(char *), compare_paths);
+    }
+
+    return total;
+}
+
+void usage(const char *program)
+{
+    printf("usage: %s [--threads N] [--cycles K] [--ips N] [--seeds S] [--interp | --jit] [--quiet]\n", program);
+    printf("       rom-archive-movie-or-dir...\n");
+    printf("  --threads N  worker threads, at most %d (default: one per core)\n", CHIP8_POOL_MAX_THREADS);
+    printf("  --cycles K   stop each instance after K instructions (default %d)\n", DEFAULT_CYCLES);
+    printf("  --ips N      clock the timers as if running at N instructions per second, at\n");
+    printf("               least 60 (default %d)\n", DEFAULT_IPS);
+    printf("  --seeds S    run every rom with seeds 0..S-1 (default 1)\n");
+    printf("  --interp     decode every instruction instead of running cached blocks\n");
+    printf("  --jit        translate hot blocks to native code (x86-64 only)\n");
+    printf("  --quiet      only print the summary\n");
+    printf("a .c8mv movie plays back once, for as long as it was recorded\n");
+}
+
+// the number after option, anything but a whole number in range is an error
+static bool number_option(const char *option, const char *text, uint64_t min, uint64_t max, uint64_t *value)
+{
+    if (!chip8_parse_number(text, min, max, value))
+    {
+        fprintf(stderr, "Error: bad value for %s %s\n", option, text);
+        return false;
+    }
+    return true;
+}
+
+static int out_of_memory(void)
+{
+    fprintf(stderr, "Error: %s\n", chip8_strerror(CHIP8_ERR_NO_MEMORY));
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct Chip8Pool pool;
+    uint32_t ips = DEFAULT_IPS;
+    uint32_t seeds = 1;
+    bool quiet = false;
+    // roms can come before, between or after the options, they are gathered
+    // at the front of argv as the options are read
+    char **roms = argv + 1;
+    int rom_args = 0;
+    uint64_t number;
+
+    pool.threads = 0;
+    pool.backend = CHIP8_BACKEND_CACHED;
+    pool.max_cycles = DEFAULT_CYCLES;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], 1, CHIP8_POOL_MAX_THREADS, &number))
+            {
+                return 1;
+            }
+            pool.threads = (int)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], 1, UINT64_MAX, &number))
+            {
+                return 1;
+            }
+            pool.max_cycles = number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+        {
+            // the timers tick after a whole number of instructions
+            if (!number_option(argv[i], argv[i + 1], 60, UINT32_MAX, &number))
+            {
+                return 1;
+            }
+            ips = (uint32_t)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--seeds") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], 1, UINT32_MAX, &number))
+            {
+                return 1;
+            }
+            seeds = (uint32_t)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--interp") == 0)
+        {
+            pool.backend = CHIP8_BACKEND_INTERP;
+        }
+        else if (strcmp(argv[i], "--jit") == 0)
+        {
+            pool.backend = CHIP8_BACKEND_JIT;
+        }
+        else if (strcmp(argv[i], "--quiet") == 0)
+        {
+            quiet = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            roms[rom_args++] = argv[i];
+        }
+    }
+
+    if (rom_args == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    pool.cycles_per_tick = ips / 60;
+
+    char **paths;
+    int path_count = collect_inputs(roms, rom_args, &paths);
+    if (path_count < 0)
+    {
+        return out_of_memory();
+    }
+
+    // one freshly loaded machine per rom, copied for every job. names[i] is
+    // what gets printed for machines[i], an archive's roms show up as
+    // archive:name. movies are kept apart, each one is a single job
+    int capacity = path_count;
+    struct Chip8 *machines = malloc(capacity * sizeof(struct Chip8));
+    char **names = malloc(capacity * sizeof(char *));
+    char **movies = malloc(capacity * sizeof(char *));
+    if (path_count > 0 && (machines == NULL || names == NULL || movies == NULL))
+    {
+        return out_of_memory();
+    }
+    int loaded = 0;
+    int movie_count = 0;
+    int failed = 0;
+    for (int i = 0; i < path_count; i++)
+    {
+        if (has_extension(paths[i], ".c8mv"))
+        {
+            movies[movie_count++] = paths[i];
+            continue;
+        }
+
+        if (!has_extension(paths[i], ".c8pk"))
+        {
+            initialize_chip8(&machines[loaded]);
+            int error = load_program_to_memory(paths[i], &machines[loaded]);
+            if (error != CHIP8_OK)
+            {
+                fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), paths[i]);
+                free(paths[i]);
+                failed++;
+                continue;
+            }
+            names[loaded++] = paths[i];
+            continue;
+        }
+
+        // one mapping and one copy per rom, no file is opened per rom
+        struct Chip8Corpus corpus;
+        int error = chip8_corpus_open(&corpus, paths[i]);
+        if (error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), paths[i]);
+            free(paths[i]);
+            failed++;
+            continue;
+        }
+
+        capacity += corpus.count;
+        struct Chip8 *grown_machines = realloc(machines, capacity * sizeof(struct Chip8));
+        if (grown_machines == NULL)
+        {
+            return out_of_memory();
+        }
+        machines = grown_machines;
+        char **grown_names = realloc(names, capacity * sizeof(char *));
+        if (grown_names == NULL)
+        {
+            return out_of_memory();
+        }
+        names = grown_names;
+
+        for (uint32_t j = 0; j < corpus.count; j++)
+        {
+            initialize_chip8(&machines[loaded]);
+            error = chip8_corpus_load(&corpus.entries[j], &machines[loaded]);
+            if (error != CHIP8_OK)
+            {
+                fprintf(stderr, "Error: %s %s:%s\n", chip8_strerror(error), paths[i], corpus.entries[j].name);
+                failed++;
+                continue;
+            }
+
+            size_t len = strlen(paths[i]) + strlen(corpus.entries[j].name) + 2;
+            names[loaded] = malloc(len);
+            if (names[loaded] == NULL)
+            {
+                return out_of_memory();
+            }
+            snprintf(names[loaded], len, "%s:%s", paths[i], corpus.entries[j].name);
+            loaded++;
+        }
+        chip8_corpus_close(&corpus);
+        free(paths[i]);
+    }
+
+    // roms first, every one once per seed, then the movies
+    uint64_t rom_jobs = (uint64_t)loaded * seeds;
+    if (rom_jobs + movie_count > UINT32_MAX)
+    {
+        fprintf(stderr, "Error: more than %u instances\n", UINT32_MAX);
+        return 1;
+    }
+    uint32_t job_count = (uint32_t)(rom_jobs + movie_count);
+    if (job_count == 0)
+    {
+        fprintf(stderr, "Error: no roms to run\n");
+        return 1;
+    }
+
+    struct Chip8Job *jobs = malloc(job_count * sizeof(struct Chip8Job));
+    if (jobs == NULL)
+    {
+        return out_of_memory();
+    }
+    for (uint32_t i = 0; i < job_count; i++)
+    {
+        jobs[i].rom = i < rom_jobs ? &machines[i / seeds] : NULL;
+        jobs[i].seed = i < rom_jobs ? i % seeds : 0;
+        jobs[i].movie = i < rom_jobs ? NULL : movies[i - rom_jobs];
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int error = chip8_pool_run(&pool, jobs, job_count);
+    if (error != CHIP8_OK)
+    {
+        fprintf(stderr, "Error: %s\n", chip8_strerror(error));
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    uint64_t total_cycles = 0;
+    for (int i = 0; i < pool.thread_count; i++)
+    {
+        total_cycles += pool.thread_stats[i].cycles;
+    }
+
+    for (uint32_t i = 0; i < job_count; i++)
+    {
+        struct Chip8Job *job = &jobs[i];
+        if (job->error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(job->error), job->movie);
+            failed++;
+            continue;
+        }
+        if (quiet)
+        {
+            continue;
+        }
+
+        if (job->movie != NULL)
+        {
+            printf("%s replay:", job->movie);
+        }
+        else
+        {
+            printf("%s seed=%u:", names[i / seeds], job->seed);
+        }
+        printf(" %s cycles=%llu pc=0x%03X gfx=%016llx\n",
+               job->halted ? "halted" : "budget",
+               (unsigned long long)job->cycles,
+               job->pc,
+               (unsigned long long)job->gfx_hash);
+    }
+
+    if (!quiet)
+    {
+        for (int i = 0; i < pool.thread_count; i++)
+        {
+            printf("thread %d: jobs=%u steals=%u cycles=%llu\n",
+                   i,
+                   pool.thread_stats[i].jobs,
+                   pool.thread_stats[i].steals,
+                   (unsigned long long)pool.thread_stats[i].cycles);
+        }
+    }
+
+    printf("total: instances=%u threads=%d cycles=%llu seconds=%.3f ips=%.0f\n",
+           job_count,
+           pool.thread_count,
+           (unsigned long long)total_cycles,
+           seconds,
+           seconds > 0 ? total_cycles / seconds : 0);
+
+    return failed == 0 ? 0 : 1;
+}
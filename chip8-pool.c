@@ -0,0 +1,299 @@
+//
+//  chip8-pool.c
+//  first c++ project
+//
+//  Work-stealing thread pool for headless runs. Every job is an
+//  independent struct Chip8, copied from its rom and seeded, or a movie
+//  played back from its file. Each worker starts with an equal slice of
+//  the jobs and steals half of another worker's remaining slice when it
+//  runs dry. Native builds only.
+//
+
+#include "chip8.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct Pool;
+
+// each worker owns a range of job indices packed into one atomic word,
+// head in the low half and tail in the high half. the owner pops from the
+// head, thieves take the upper half of the range from the tail. aligned to
+// a cache line so workers don't false share their counters
+struct Worker
+{
+    _Alignas(64) _Atomic uint64_t range;
+    pthread_t thread;
+    int index;
+    struct Chip8PoolThread *stats;
+    struct Chip8Cache *cache; // blocks decoded by this worker, flushed by every fresh job
+    struct Chip8Jit *jit;     // only with the jit backend, same lifetime as the cache
+    struct Pool *pool;
+};
+
+struct Pool
+{
+    struct Worker workers[CHIP8_POOL_MAX_THREADS];
+    int worker_count;
+    const struct Chip8Pool *config;
+    struct Chip8Job *jobs;
+};
+
+static uint64_t pack_range(uint32_t head, uint32_t tail)
+{
+    return (uint64_t)tail << 32 | head;
+}
+
+static bool pop_job(struct Worker *worker, uint32_t *job)
+{
+    uint64_t range = atomic_load(&worker->range);
+    for (;;)
+    {
+        uint32_t head = (uint32_t)range;
+        uint32_t tail = (uint32_t)(range >> 32);
+        if (head >= tail)
+        {
+            return false;
+        }
+
+        if (atomic_compare_exchange_weak(&worker->range, &range, pack_range(head + 1, tail)))
+        {
+            *job = head;
+            return true;
+        }
+    }
+}
+
+static bool steal_jobs(struct Worker *thief, struct Worker *victim)
+{
+    uint64_t range = atomic_load(&victim->range);
+    for (;;)
+    {
+        uint32_t head = (uint32_t)range;
+        uint32_t tail = (uint32_t)(range >> 32);
+        if (head >= tail)
+        {
+            return false;
+        }
+
+        uint32_t take = (tail - head + 1) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &range, pack_range(head, tail - take)))
+        {
+            atomic_store(&thief->range, pack_range(tail - take, tail));
+            thief->stats->steals++;
+            return true;
+        }
+    }
+}
+
+static uint64_t run_backend(struct Worker *worker, struct Chip8 *chip8, uint64_t max_cycles)
+{
+    const struct Chip8Pool *config = worker->pool->config;
+
+    if (config->backend == CHIP8_BACKEND_JIT)
+    {
+        return chip8_run_jit(chip8, worker->jit, max_cycles, config->cycles_per_tick);
+    }
+    else if (config->backend == CHIP8_BACKEND_INTERP)
+    {
+        return chip8_run(chip8, max_cycles, config->cycles_per_tick);
+    }
+    return chip8_run_cached(chip8, worker->cache, max_cycles, config->cycles_per_tick);
+}
+
+// copying the freshly loaded rom marks all of its pages written, which is
+// what flushes the cache and jit between jobs. restarting, a rom that halts
+// on its first instruction can't use up the budget
+static void run_rom(struct Worker *worker, struct Chip8Job *job, struct Chip8 *chip8)
+{
+    const struct Chip8Pool *config = worker->pool->config;
+    uint64_t ran;
+
+    for (;;)
+    {
+        *chip8 = *job->rom;
+        chip8_seed(chip8, job->seed);
+        ran = run_backend(worker, chip8, config->max_cycles - job->cycles);
+        job->cycles += ran;
+
+        if (!config->restart || ran == 0 || job->cycles >= config->max_cycles)
+        {
+            break;
+        }
+        job->restarts++;
+    }
+}
+
+static void run_job(struct Worker *worker, struct Chip8Job *job)
+{
+    struct Chip8 chip8;
+
+    job->cycles = 0;
+    job->restarts = 0;
+    job->error = CHIP8_OK;
+    if (job->movie == NULL)
+    {
+        run_rom(worker, job, &chip8);
+    }
+    else
+    {
+        // a movie plays through the interpreter for exactly as long as it
+        // was recorded, whatever the budget
+        job->error = chip8_replay(job->movie, &chip8, &job->cycles);
+        if (job->error != CHIP8_OK)
+        {
+            worker->stats->jobs++;
+            return;
+        }
+    }
+
+    job->halted = chip8_is_halted(&chip8);
+    job->pc = chip8.pc;
+    job->I = chip8.I;
+    job->sp = chip8.sp;
+    job->delay_timer = chip8.delay_timer;
+    job->sound_timer = chip8.sound_timer;
+    memcpy(job->v_register, chip8.v_register, sizeof(job->v_register));
+    job->gfx_hash = chip8_gfx_hash(&chip8);
+
+    worker->stats->cycles += job->cycles;
+    worker->stats->jobs++;
+}
+
+static void *worker_main(void *arg)
+{
+    struct Worker *worker = (struct Worker *)arg;
+    struct Pool *pool = worker->pool;
+    uint32_t job;
+
+    for (;;)
+    {
+        while (pop_job(worker, &job))
+        {
+            run_job(worker, &pool->jobs[job]);
+        }
+
+        // jobs are never added once the pool starts, so a full pass over
+        // the other workers without a successful steal means we are done
+        bool stole = false;
+        for (int i = 1; i < pool->worker_count && !stole; i++)
+        {
+            struct Worker *victim = &pool->workers[(worker->index + i) % pool->worker_count];
+            stole = steal_jobs(worker, victim);
+        }
+
+        if (!stole)
+        {
+            return NULL;
+        }
+    }
+}
+
+static void free_workers(struct Pool *pool)
+{
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        free(pool->workers[i].cache);
+        chip8_jit_destroy(pool->workers[i].jit);
+    }
+}
+
+int chip8_pool_run(struct Chip8Pool *config, struct Chip8Job *jobs, uint32_t count)
+{
+    long threads = config->threads > 0 ? config->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > CHIP8_POOL_MAX_THREADS)
+    {
+        threads = CHIP8_POOL_MAX_THREADS;
+    }
+    if (threads > count)
+    {
+        threads = count;
+    }
+
+    // the workers are aligned to cache lines, which calloc doesn't promise
+    struct Pool *pool = aligned_alloc(_Alignof(struct Pool), sizeof(struct Pool));
+    if (pool == NULL)
+    {
+        return CHIP8_ERR_NO_MEMORY;
+    }
+    memset(pool, 0, sizeof(struct Pool));
+    pool->config = config;
+    pool->jobs = jobs;
+    pool->worker_count = (int)threads;
+    config->thread_count = (int)threads;
+    memset(config->thread_stats, 0, sizeof(config->thread_stats));
+
+    // hand every worker an equal slice up front, stealing evens out the rest
+    int error = CHIP8_OK;
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        struct Worker *worker = &pool->workers[i];
+        uint32_t head = (uint64_t)count * i / pool->worker_count;
+        uint32_t tail = (uint64_t)count * (i + 1) / pool->worker_count;
+        atomic_init(&worker->range, pack_range(head, tail));
+        worker->index = i;
+        worker->pool = pool;
+        worker->stats = &config->thread_stats[i];
+
+        if (config->backend == CHIP8_BACKEND_JIT)
+        {
+            worker->jit = chip8_jit_create();
+            if (worker->jit == NULL)
+            {
+                error = CHIP8_ERR_NO_JIT;
+            }
+        }
+        else if (config->backend == CHIP8_BACKEND_CACHED)
+        {
+            worker->cache = malloc(sizeof(struct Chip8Cache));
+            if (worker->cache == NULL)
+            {
+                error = CHIP8_ERR_NO_MEMORY;
+            }
+            else
+            {
+                chip8_cache_reset(worker->cache);
+            }
+        }
+    }
+
+    if (error != CHIP8_OK)
+    {
+        free_workers(pool);
+        free(pool);
+        return error;
+    }
+
+    // a worker without a thread of its own runs on this one after the rest
+    // have started, and steals from them like any other
+    bool started[CHIP8_POOL_MAX_THREADS];
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        started[i] = pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) == 0;
+    }
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (!started[i])
+        {
+            worker_main(&pool->workers[i]);
+        }
+    }
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+
+    free_workers(pool);
+    free(pool);
+    return CHIP8_OK;
+}
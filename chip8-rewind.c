@@ -0,0 +1,336 @@
+//
+//  chip8-rewind.c
+//  first c++ project
+//
+//  Rewind history. Every frame is a save state; a keyframe stores it
+//  whole, the frames after it store what changed since the frame before,
+//  both run length encoded over the XOR with their base. Records sit in
+//  one fixed ring and the oldest keyframe and its deltas go first when
+//  the ring is full.
+//
+
+#include "chip8.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// 3 byte length word and a repeat count in front, the length word again
+// behind so the ring can be walked in both directions. a 64 KB machine's
+// keyframe needs the third byte
+#define REWIND_WORD 3
+#define REWIND_OVERHEAD (2 * REWIND_WORD + 1)
+#define REWIND_REPEAT REWIND_WORD
+#define REWIND_DATA (REWIND_WORD + 1)
+// every token is a 2 byte run of unchanged bytes, a 1 byte literal count
+// and up to 255 changed bytes. only tokens that follow a full literal or
+// a full run, or start the frame, cover fewer bytes than they cost
+#define REWIND_MAX_RUN 0xFFFF
+#define REWIND_RECORD_MAX (CHIP8_STATE_SIZE + 3 * (CHIP8_STATE_SIZE / 255 + CHIP8_STATE_SIZE / REWIND_MAX_RUN + 2))
+// fewer unchanged bytes than this are cheaper inside a literal
+#define REWIND_MIN_RUN 3
+
+struct Chip8Rewind
+{
+    size_t capacity;
+    size_t tail;   // oldest record, always a keyframe
+    size_t head;   // where the next record goes
+    size_t end;    // end of the records behind head once head wrapped to the start
+    size_t newest; // last record written
+    uint32_t records;
+    uint32_t frames; // records plus their repeats
+    uint32_t keyframe_interval;
+    uint32_t since_keyframe;           // deltas written after the newest keyframe
+    uint8_t current[CHIP8_STATE_SIZE]; // the newest frame, what the records decode to
+    uint8_t scratch[REWIND_RECORD_MAX];
+    uint8_t data[];
+};
+
+static const uint8_t blank_frame[CHIP8_STATE_SIZE];
+
+static uint32_t get_word(const uint8_t *at)
+{
+    return at[0] | at[1] << 8 | (uint32_t)at[2] << 16;
+}
+
+static void put_word(uint8_t *at, uint32_t word)
+{
+    at[0] = word;
+    at[1] = word >> 8;
+    at[2] = word >> 16;
+}
+
+static size_t record_length(const uint8_t *record)
+{
+    return get_word(record) >> 1;
+}
+
+static bool is_keyframe(const uint8_t *record)
+{
+    return record[0] & 1;
+}
+
+static size_t next_record(const struct Chip8Rewind *rewind, size_t offset)
+{
+    size_t next = offset + REWIND_OVERHEAD + record_length(&rewind->data[offset]);
+
+    // records at or past head are the ones before the wrap
+    if (offset >= rewind->head && next == rewind->end)
+    {
+        next = 0;
+    }
+    return next;
+}
+
+static size_t previous_record(const struct Chip8Rewind *rewind, size_t offset)
+{
+    size_t behind = offset == 0 ? rewind->end : offset;
+    return behind - REWIND_OVERHEAD - record_length(&rewind->data[behind - REWIND_WORD]);
+}
+
+static bool unchanged_run(const uint8_t *frame, const uint8_t *base, size_t at)
+{
+    for (size_t i = at; i < at + REWIND_MIN_RUN && i < CHIP8_STATE_SIZE; i++)
+    {
+        if (frame[i] != base[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t encode_delta(const uint8_t *frame, const uint8_t *base, uint8_t *out)
+{
+    size_t length = 0;
+    size_t at = 0;
+
+    while (at < CHIP8_STATE_SIZE)
+    {
+        size_t run = 0;
+        while (at + run < CHIP8_STATE_SIZE && run < REWIND_MAX_RUN && frame[at + run] == base[at + run])
+        {
+            run++;
+        }
+        at += run;
+
+        size_t literal = 0;
+        while (at + literal < CHIP8_STATE_SIZE && literal < 255 && !unchanged_run(frame, base, at + literal))
+        {
+            literal++;
+        }
+
+        out[length++] = run;
+        out[length++] = run >> 8;
+        out[length++] = literal;
+        for (size_t i = 0; i < literal; i++)
+        {
+            out[length++] = frame[at + i] ^ base[at + i];
+        }
+        at += literal;
+    }
+
+    return length;
+}
+
+static void apply_delta(uint8_t *frame, const uint8_t *delta, size_t length)
+{
+    size_t at = 0;
+
+    for (size_t i = 0; i < length;)
+    {
+        at += delta[i] | delta[i + 1] << 8;
+        size_t literal = delta[i + 2];
+        i += 3;
+
+        while (literal-- > 0)
+        {
+            frame[at++] ^= delta[i++];
+        }
+    }
+}
+
+// the oldest keyframe and every delta that depends on it
+static void drop_oldest(struct Chip8Rewind *rewind)
+{
+    do
+    {
+        rewind->frames -= 1 + rewind->data[rewind->tail + REWIND_REPEAT];
+        rewind->records--;
+        rewind->tail = next_record(rewind, rewind->tail);
+    } while (rewind->records != 0 && !is_keyframe(&rewind->data[rewind->tail]));
+}
+
+// makes size bytes free at head, dropping history until they are
+static void reserve(struct Chip8Rewind *rewind, size_t size)
+{
+    while (rewind->records != 0)
+    {
+        if (rewind->head > rewind->tail)
+        {
+            if (rewind->head + size <= rewind->capacity)
+            {
+                return;
+            }
+            if (size <= rewind->tail)
+            {
+                rewind->end = rewind->head;
+                rewind->head = 0;
+                return;
+            }
+        }
+        else if (rewind->head + size <= rewind->tail)
+        {
+            return;
+        }
+
+        drop_oldest(rewind);
+    }
+
+    rewind->head = 0;
+    rewind->tail = 0;
+    rewind->end = 0;
+}
+
+// decodes the newest frame again, starting from the keyframe before it
+static void rebuild_current(struct Chip8Rewind *rewind)
+{
+    size_t at = rewind->newest;
+    uint32_t deltas = 0;
+
+    while (!is_keyframe(&rewind->data[at]))
+    {
+        at = previous_record(rewind, at);
+        deltas++;
+    }
+
+    memset(rewind->current, 0, sizeof(rewind->current));
+    for (;;)
+    {
+        apply_delta(rewind->current, &rewind->data[at + REWIND_DATA], record_length(&rewind->data[at]));
+        if (at == rewind->newest)
+        {
+            break;
+        }
+        at = next_record(rewind, at);
+    }
+
+    rewind->since_keyframe = deltas;
+}
+
+struct Chip8Rewind *chip8_rewind_create(size_t capacity, uint32_t keyframe_interval)
+{
+    // always room for at least one keyframe
+    if (capacity < REWIND_RECORD_MAX + REWIND_OVERHEAD)
+    {
+        capacity = REWIND_RECORD_MAX + REWIND_OVERHEAD;
+    }
+
+    struct Chip8Rewind *rewind = malloc(sizeof(struct Chip8Rewind) + capacity);
+    if (rewind == NULL)
+    {
+        return NULL;
+    }
+
+    rewind->capacity = capacity;
+    rewind->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    chip8_rewind_clear(rewind);
+    return rewind;
+}
+
+void chip8_rewind_destroy(struct Chip8Rewind *rewind)
+{
+    free(rewind);
+}
+
+void chip8_rewind_clear(struct Chip8Rewind *rewind)
+{
+    rewind->tail = 0;
+    rewind->head = 0;
+    rewind->end = 0;
+    rewind->newest = 0;
+    rewind->records = 0;
+    rewind->frames = 0;
+    rewind->since_keyframe = 0;
+}
+
+uint32_t chip8_rewind_frames(const struct Chip8Rewind *rewind)
+{
+    return rewind->frames;
+}
+
+void chip8_rewind_push(struct Chip8Rewind *rewind, const struct Chip8 *chip8)
+{
+    uint8_t frame[CHIP8_STATE_SIZE];
+    chip8_save_state(chip8, frame, sizeof(frame));
+
+    // a paused or idle machine only bumps the repeat count
+    uint8_t *repeat = &rewind->data[rewind->newest + REWIND_REPEAT];
+    if (rewind->records != 0 && *repeat < 255 && memcmp(frame, rewind->current, sizeof(frame)) == 0)
+    {
+        (*repeat)++;
+        rewind->frames++;
+        return;
+    }
+
+    bool keyframe = rewind->records == 0 || rewind->since_keyframe + 1 >= rewind->keyframe_interval;
+    size_t length = encode_delta(frame, keyframe ? blank_frame : rewind->current, rewind->scratch);
+    reserve(rewind, length + REWIND_OVERHEAD);
+
+    // the delta's keyframe was dropped to make room
+    if (rewind->records == 0 && !keyframe)
+    {
+        keyframe = true;
+        length = encode_delta(frame, blank_frame, rewind->scratch);
+        reserve(rewind, length + REWIND_OVERHEAD);
+    }
+
+    uint8_t *record = &rewind->data[rewind->head];
+    uint32_t word = length << 1 | keyframe;
+    put_word(record, word);
+    record[REWIND_REPEAT] = 0;
+    memcpy(&record[REWIND_DATA], rewind->scratch, length);
+    put_word(&record[REWIND_DATA + length], word);
+
+    rewind->newest = rewind->head;
+    rewind->head += length + REWIND_OVERHEAD;
+    rewind->records++;
+    rewind->frames++;
+    rewind->since_keyframe = keyframe ? 0 : rewind->since_keyframe + 1;
+    memcpy(rewind->current, frame, sizeof(frame));
+}
+
+bool chip8_rewind_step(struct Chip8Rewind *rewind, struct Chip8 *chip8)
+{
+    if (rewind->frames < 2)
+    {
+        return false;
+    }
+
+    uint8_t *record = &rewind->data[rewind->newest];
+    if (record[REWIND_REPEAT] != 0)
+    {
+        record[REWIND_REPEAT]--;
+    }
+    else
+    {
+        size_t dropped = rewind->newest;
+        rewind->newest = previous_record(rewind, dropped);
+        // dropping the first record after the wrap unwraps the ring
+        rewind->head = dropped == 0 ? rewind->end : dropped;
+        rewind->records--;
+
+        if (is_keyframe(record))
+        {
+            rebuild_current(rewind);
+        }
+        else
+        {
+            // XOR with the frame before gives the frame before back
+            apply_delta(rewind->current, &record[REWIND_DATA], record_length(record));
+            rewind->since_keyframe--;
+        }
+    }
+
+    rewind->frames--;
+    return chip8_load_state(chip8, rewind->current, sizeof(rewind->current)) == CHIP8_OK;
+}
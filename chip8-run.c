@@ -0,0 +1,311 @@
+//
+//  chip8-run.c
+//  first c++ project
+//
+//  Headless batch runner: loads each ROM, runs it uncapped for a fixed
+//  cycle budget or until it parks on a 1NNN self-jump, then prints the
+//  final machine state. No window, no frame delay.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+
+#define DEFAULT_CYCLES 10000000
+// the timers tick at 60HZ, so at the default clock they tick every ~11 instructions
+#define DEFAULT_IPS 700
+
+void usage(const char *program)
+{
+    printf("usage: %s [--cycles K] [--ips N] [--seed S] [--quirks P] [--corpus F] [--interp | --jit] [--quiet] [--verbose] rom...\n", program);
+    printf("       %s --replay movie\n", program);
+    printf("  --cycles K  stop after K instructions (default %d)\n", DEFAULT_CYCLES);
+    printf("  --ips N     clock the timers as if running at N instructions per second, at\n");
+    printf("              least 60 (default %d)\n", DEFAULT_IPS);
+    printf("  --seed S    seed for the CXNN random generator (default 0)\n");
+    printf("  --quirks P  behave like xochip (default), vip, chip48 or schip\n");
+    printf("  --corpus F  run every rom in the chip8-pack archive F, or with roms given, take\n");
+    printf("              their quirk profiles from it\n");
+    printf("  --interp    decode every instruction instead of running cached blocks\n");
+    printf("  --jit       translate hot blocks to native code (x86-64 only)\n");
+    printf("  --quiet     only print the summary line\n");
+    printf("  --verbose   also print what the cpu reported, unknown opcodes and key waits\n");
+    printf("  --replay F  play back a movie recorded with main --record and print the final state\n");
+}
+
+void print_state(const char *rom, const struct Chip8 *chip8, uint64_t cycles)
+{
+    printf("%s: %s cycles=%llu pc=0x%03X I=0x%03X sp=%u dt=%u st=%u v=",
+           rom,
+           chip8_is_halted(chip8) ? "halted" : "budget",
+           (unsigned long long)cycles,
+           chip8->pc,
+           chip8->I,
+           chip8->sp,
+           chip8->delay_timer,
+           chip8->sound_timer);
+
+    for (int i = 0; i < 16; i++)
+    {
+        printf("%02X", chip8->v_register[i]);
+    }
+
+    printf(" gfx=%016llx\n", (unsigned long long)chip8_gfx_hash(chip8));
+}
+
+void print_diagnostics(struct Chip8Diag *diag)
+{
+    struct Chip8DiagEvent event;
+    while (chip8_diag_read(diag, &event))
+    {
+        printf("  %s: 0x%04X at 0x%03X x%u\n", chip8_diag_message(event.code), event.opcode, event.pc, event.count);
+    }
+
+    uint32_t dropped = chip8_diag_dropped(diag);
+    if (dropped != 0)
+    {
+        printf("  %u diagnostics dropped\n", dropped);
+    }
+}
+
+// the number after option, anything but a whole number in range is an error
+static bool number_option(const char *option, const char *text, uint64_t min, uint64_t max, uint64_t *value)
+{
+    if (!chip8_parse_number(text, min, max, value))
+    {
+        fprintf(stderr, "Error: bad value for %s %s\n", option, text);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t max_cycles = DEFAULT_CYCLES;
+    uint32_t ips = DEFAULT_IPS;
+    uint32_t seed = 0;
+    int quirks = CHIP8_QUIRKS_COUNT; // unless given, the corpus or the default decides
+    const char *corpus_path = NULL;
+    int quiet = 0;
+    int verbose = 0;
+    int interp = 0;
+    int use_jit = 0;
+    // roms can come before, between or after the options, they are gathered
+    // at the front of argv as the options are read
+    char **roms = argv + 1;
+    int rom_args = 0;
+    const char *replay = NULL;
+    uint64_t number;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], 1, UINT64_MAX, &number))
+            {
+                return 1;
+            }
+            max_cycles = number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+        {
+            // the timers tick after a whole number of instructions
+            if (!number_option(argv[i], argv[i + 1], 60, UINT32_MAX, &number))
+            {
+                return 1;
+            }
+            ips = (uint32_t)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            if (!number_option(argv[i], argv[i + 1], 0, UINT32_MAX, &number))
+            {
+                return 1;
+            }
+            seed = (uint32_t)number;
+            i++;
+        }
+        else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc)
+        {
+            quirks = chip8_quirks_from_name(argv[++i]);
+            if (quirks == CHIP8_QUIRKS_COUNT)
+            {
+                fprintf(stderr, "Error: unknown quirk profile %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc)
+        {
+            corpus_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--interp") == 0)
+        {
+            interp = 1;
+        }
+        else if (strcmp(argv[i], "--jit") == 0)
+        {
+            use_jit = 1;
+        }
+        else if (strcmp(argv[i], "--quiet") == 0)
+        {
+            quiet = 1;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = 1;
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replay = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            roms[rom_args++] = argv[i];
+        }
+    }
+
+    if (replay != NULL)
+    {
+        struct Chip8 chip8;
+        uint64_t cycles;
+        int error = chip8_replay(replay, &chip8, &cycles);
+        if (error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), replay);
+            return 1;
+        }
+
+        print_state(replay, &chip8, cycles);
+        return 0;
+    }
+
+    if (rom_args == 0 && corpus_path == NULL)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct Chip8Corpus corpus = {0};
+    if (corpus_path != NULL)
+    {
+        int error = chip8_corpus_open(&corpus, corpus_path);
+        if (error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), corpus_path);
+            return 1;
+        }
+    }
+    // with no roms given the whole corpus runs
+    int rom_count = rom_args > 0 ? rom_args : (int)corpus.count;
+
+    uint32_t cycles_per_tick = ips / 60;
+    uint64_t total_cycles = 0;
+    int failed = 0;
+    struct Chip8 chip8;
+    static struct Chip8Cache cache;
+    struct Chip8Jit *jit = NULL;
+    static struct Chip8Diag diag;
+#ifdef CHIP8_PROFILE
+    static struct Chip8Profile profile;
+#endif
+
+    if (use_jit)
+    {
+        jit = chip8_jit_create();
+        if (jit == NULL)
+        {
+            fprintf(stderr, "Error: no jit on this target\n");
+            return 1;
+        }
+    }
+
+    clock_t start = clock();
+
+    for (int i = 0; i < rom_count; i++)
+    {
+        initialize_chip8(&chip8);
+        chip8_seed(&chip8, seed);
+        if (verbose)
+        {
+            chip8_diag_init(&diag);
+            chip8.diag = &diag;
+        }
+#ifdef CHIP8_PROFILE
+        chip8_profile_reset(&profile);
+        chip8.profile = &profile;
+#endif
+
+        const char *name;
+        int error;
+        if (rom_args > 0)
+        {
+            name = roms[i];
+            error = chip8_corpus_load_file(corpus_path != NULL ? &corpus : NULL, name, &chip8);
+        }
+        else
+        {
+            name = corpus.entries[i].name;
+            error = chip8_corpus_load(&corpus.entries[i], &chip8);
+        }
+        if (error != CHIP8_OK)
+        {
+            fprintf(stderr, "Error: %s %s\n", chip8_strerror(error), name);
+            failed++;
+            continue;
+        }
+        if (quirks != CHIP8_QUIRKS_COUNT)
+        {
+            chip8.quirks = quirks;
+        }
+
+        uint64_t cycles;
+        if (jit != NULL)
+        {
+            cycles = chip8_run_jit(&chip8, jit, max_cycles, cycles_per_tick);
+        }
+        else if (interp)
+        {
+            cycles = chip8_run(&chip8, max_cycles, cycles_per_tick);
+        }
+        else
+        {
+            cycles = chip8_run_cached(&chip8, &cache, max_cycles, cycles_per_tick);
+        }
+        total_cycles += cycles;
+
+        if (!quiet)
+        {
+            print_state(name, &chip8, cycles);
+            if (verbose)
+            {
+                print_diagnostics(&diag);
+            }
+#ifdef CHIP8_PROFILE
+            chip8_profile_report(&profile, stdout);
+#endif
+        }
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    chip8_jit_destroy(jit);
+    chip8_corpus_close(&corpus);
+    printf("total: roms=%d failed=%d cycles=%llu seconds=%.3f ips=%.0f\n",
+           rom_count,
+           failed,
+           (unsigned long long)total_cycles,
+           seconds,
+           seconds > 0 ? total_cycles / seconds : 0);
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,545 @@
+//
+//  chip8-test.c
+//  first c++ project
+//
+//  Regression checks for the headless core, run by make check. Every rom
+//  given, plus a few built in programs that reach the corners the bundled
+//  roms don't, goes through each check. A check compares whole machines
+//  through their save states, so any register, memory, framebuffer or
+//  generator difference fails it.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+#define MAX_PROGRAMS 64
+// the timers tick every 11 instructions, as at the default 700 ips
+#define CYCLES_PER_TICK 11
+#define REWIND_FRAMES 48
+#define MOVIE_FILE "chip8-test.c8mv"
+
+struct Program
+{
+    const char *name;
+    struct Chip8 machine; // freshly loaded, copied for every run
+};
+
+// hires, then a loop of FX33/FX55 stores and DXYN draws with a scroll after
+// each, so every store and framebuffer path runs within a few hundred cycles
+static const uint8_t store_draw_program[] = {
+    0x00, 0xFF, // 200: hires
+    0x60, 0x05, // 202: V0 = 5
+    0xA3, 0x00, // 204: I = 0x300
+    0xF0, 0x33, // 206: BCD of V0
+    0xF2, 0x55, // 208: store V0-V2
+    0xF0, 0x29, // 20A: I = font for V0
+    0xD0, 0x15, // 20C: draw 5 rows at V0, V1
+    0x00, 0xC4, // 20E: scroll down 4
+    0x00, 0xFB, // 210: scroll right 4
+    0x70, 0x07, // 212: V0 += 7
+    0x71, 0x03, // 214: V1 += 3
+    0xC2, 0x3F, // 216: V2 = random
+    0x42, 0x00, // 218: skip the clear unless V2 is 0
+    0x00, 0xE0, // 21A: clear
+    0x12, 0x04, // 21C: jump 204
+};
+
+// counts with a carry into V2 and, only while V2 is 4, rewrites the
+// instruction at 212 a few cycles after fetching past it. a snapshot taken
+// early holds the old code, so the cache has to forget the rewritten one
+// when it is loaded back
+static const uint8_t self_modify_program[] = {
+    0x60, 0x73, // 200: V0 = 0x73
+    0x66, 0x01, // 202: V6 = 1
+    0x81, 0x64, // 204: V1 += 1, VF = carry
+    0x82, 0xF4, // 206: V2 += carry
+    0xA2, 0x12, // 208: I = 0x212
+    0x42, 0x04, // 20A: skip the store unless V2 is 4
+    0xF1, 0x55, // 20C: store V0-V1 over 212
+    0x64, 0x00, // 20E: V4 = 0
+    0x64, 0x00, // 210: V4 = 0
+    0x73, 0x00, // 212: V3 += NN, rewritten
+    0x12, 0x04, // 214: jump 204
+};
+
+#if CHIP8_MEMORY_SIZE > 0x1000
+// puts a call to 21E at FFFC and jumps to 21E at 0 and 2, then runs on
+// through empty memory into the call. from then on 21E rewrites FFFE to
+// V3 += V5 and returns, and with the stack wrapping around every 16th
+// return lands on FFFE again. the block there wraps around to the jump
+// at 0, and has to be dropped whenever it is rewritten
+static const uint8_t memory_end_program[] = {
+    0xF0, 0x00, // 200: I = FFFC
+    0xFF, 0xFC, // 202
+    0x60, 0x22, // 204: V0-V3 = call 21E, V3 += 0
+    0x61, 0x1E, // 206
+    0x62, 0x73, // 208
+    0x63, 0x00, // 20A
+    0xF3, 0x55, // 20C: store V0-V3 at FFFC
+    0xA0, 0x00, // 20E: I = 0
+    0x60, 0x12, // 210: V0-V3 = jump 21E, jump 21E
+    0x61, 0x1E, // 212
+    0x62, 0x12, // 214
+    0x63, 0x1E, // 216
+    0xF3, 0x55, // 218: store V0-V3 at 0
+    0x63, 0x00, // 21A: V3 = 0
+    0x12, 0x2C, // 21C: jump into the empty memory after the program
+    0xF0, 0x00, // 21E: I = FFFE
+    0xFF, 0xFE, // 220
+    0x60, 0x73, // 222: V0 = 0x73
+    0x81, 0x50, // 224: V1 = V5
+    0xF1, 0x55, // 226: store V0-V1 at FFFE
+    0x75, 0x01, // 228: V5 += 1
+    0x00, 0xEE, // 22A: return
+};
+#endif
+
+static const struct
+{
+    const char *name;
+    const uint8_t *code;
+    size_t size;
+} builtin_programs[] = {
+    {"store-draw", store_draw_program, sizeof(store_draw_program)},
+    {"self-modify", self_modify_program, sizeof(self_modify_program)},
+#if CHIP8_MEMORY_SIZE > 0x1000
+    {"memory-end", memory_end_program, sizeof(memory_end_program)},
+#endif
+};
+
+static struct Program programs[MAX_PROGRAMS];
+static int program_count;
+static int checks;
+static int failures;
+
+static struct Chip8Cache cache;
+static struct Chip8Jit *jit;
+// every frame pushed to a rewind ring, by frame number
+static uint8_t history[REWIND_FRAMES][CHIP8_STATE_SIZE];
+
+static void fail(const char *check, const struct Program *program, const char *what)
+{
+    printf("FAIL %s %s: %s\n", check, program->name, what);
+    failures++;
+}
+
+static bool same_state(const struct Chip8 *a, const struct Chip8 *b)
+{
+    static uint8_t left[CHIP8_STATE_SIZE];
+    static uint8_t right[CHIP8_STATE_SIZE];
+    chip8_save_state(a, left, sizeof(left));
+    chip8_save_state(b, right, sizeof(right));
+    return memcmp(left, right, sizeof(left)) == 0 && chip8_gfx_hash(a) == chip8_gfx_hash(b);
+}
+
+// the keys held while a run is split into chunks, so FX0A and EX9E/EXA1
+// see presses and releases at the same cycles on every backend
+static void press_keys(struct Chip8 *chip8, int chunk)
+{
+    int key = chunk * 7 % 16;
+    handle_keypres(chip8, key, chunk % 3 != 0);
+}
+
+// the interpreter, the block cache and the jit run the same machine in the
+// same uneven chunks and have to agree after every one of them
+static void check_backends(const struct Program *program)
+{
+    static const uint32_t chunks[] = {1, 2, 7, 100, 13, 1000, 3, 10000, 50000, 137, 100000};
+
+    for (uint32_t seed = 0; seed < 2; seed++)
+    {
+        struct Chip8 interp = program->machine;
+        struct Chip8 cached = program->machine;
+        struct Chip8 native = program->machine;
+        chip8_seed(&interp, seed);
+        chip8_seed(&cached, seed);
+        chip8_seed(&native, seed);
+        chip8_cache_reset(&cache);
+        if (jit != NULL)
+        {
+            chip8_jit_reset(jit);
+        }
+
+        checks++;
+        for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+        {
+            uint64_t ran = chip8_run(&interp, chunks[i], CYCLES_PER_TICK);
+            if (chip8_run_cached(&cached, &cache, chunks[i], CYCLES_PER_TICK) != ran || !same_state(&interp, &cached))
+            {
+                fail("backends", program, "the block cache differs from the interpreter");
+                return;
+            }
+            if (jit != NULL && (chip8_run_jit(&native, jit, chunks[i], CYCLES_PER_TICK) != ran || !same_state(&interp, &native)))
+            {
+                fail("backends", program, "the jit differs from the interpreter");
+                return;
+            }
+
+            press_keys(&interp, i);
+            press_keys(&cached, i);
+            press_keys(&native, i);
+        }
+    }
+}
+
+// a machine restored from a snapshot carries on exactly like the one it
+// was taken from, and the block cache running it notices the swap. a
+// truncated or mislabelled snapshot is turned away without a trace
+static void check_snapshots(const struct Program *program)
+{
+    static uint8_t state[CHIP8_STATE_SIZE];
+    static uint8_t again[CHIP8_STATE_SIZE];
+
+    struct Chip8 original = program->machine;
+    chip8_seed(&original, 7);
+    chip8_run(&original, 5000, CYCLES_PER_TICK);
+    handle_keypres(&original, 5, true);
+
+    checks++;
+    if (chip8_save_state(&original, state, sizeof(state) - 1) != 0 ||
+        chip8_save_state(&original, state, sizeof(state)) != CHIP8_STATE_SIZE)
+    {
+        fail("snapshots", program, "save state size");
+        return;
+    }
+
+    struct Chip8 restored = program->machine;
+    if (chip8_load_state(&restored, state, sizeof(state)) != CHIP8_OK)
+    {
+        fail("snapshots", program, "a saved state doesn't load");
+        return;
+    }
+    chip8_save_state(&restored, again, sizeof(again));
+    if (memcmp(state, again, sizeof(state)) != 0 || !same_state(&original, &restored))
+    {
+        fail("snapshots", program, "saving a loaded state gives different bytes");
+        return;
+    }
+
+    // the cache and the jit have run the restored machine past the
+    // snapshot, loading it again has to drop whatever they kept from the
+    // later memory
+    struct Chip8 native = restored;
+    chip8_cache_reset(&cache);
+    chip8_run_cached(&restored, &cache, 20000, CYCLES_PER_TICK);
+    chip8_load_state(&restored, state, sizeof(state));
+    chip8_run_cached(&restored, &cache, 20000, CYCLES_PER_TICK);
+    chip8_run(&original, 20000, CYCLES_PER_TICK);
+    if (!same_state(&original, &restored))
+    {
+        fail("snapshots", program, "a loaded state runs differently in the block cache");
+        return;
+    }
+    if (jit != NULL)
+    {
+        chip8_jit_reset(jit);
+        chip8_run_jit(&native, jit, 20000, CYCLES_PER_TICK);
+        chip8_load_state(&native, state, sizeof(state));
+        chip8_run_jit(&native, jit, 20000, CYCLES_PER_TICK);
+        if (!same_state(&original, &native))
+        {
+            fail("snapshots", program, "a loaded state runs differently in the jit");
+            return;
+        }
+    }
+
+    struct Chip8 untouched = restored;
+    state[4]++;
+    int version = chip8_load_state(&restored, state, sizeof(state));
+    state[4]--;
+    if (version != CHIP8_ERR_BAD_STATE ||
+        chip8_load_state(&restored, state, sizeof(state) - 1) != CHIP8_ERR_BAD_STATE ||
+        !same_state(&untouched, &restored))
+    {
+        fail("snapshots", program, "a bad state was loaded");
+    }
+}
+
+// a forked child runs like a full copy of its parent on every backend,
+// however many of the shared pages it takes over, and rolling it back
+// gives the parent again. the cache and the jit are kept across children
+// like a tree search would keep them. the parent never changes
+static void check_forks(const struct Program *program)
+{
+    static uint8_t before[CHIP8_STATE_SIZE];
+    static uint8_t after[CHIP8_STATE_SIZE];
+
+    struct Chip8 parent = program->machine;
+    chip8_seed(&parent, 3);
+    chip8_run(&parent, 3000, CYCLES_PER_TICK);
+    chip8_save_state(&parent, before, sizeof(before));
+    chip8_cache_reset(&cache);
+    if (jit != NULL)
+    {
+        chip8_jit_reset(jit);
+    }
+
+    checks++;
+    struct Chip8 child;
+    chip8_fork(&child, &parent);
+    if (!same_state(&child, &parent))
+    {
+        fail("forks", program, "a new child differs from its parent");
+        return;
+    }
+
+    // three runs of growing length on each backend in turn, so a backend
+    // carries on from what it kept before the last rollback
+    for (uint32_t round = 0; round < 9; round++)
+    {
+        uint32_t cycles = 2000 << round % 3 * 2;
+        struct Chip8 copy = parent;
+        chip8_run(&copy, cycles, CYCLES_PER_TICK);
+        if (round / 3 == 1)
+        {
+            chip8_run_cached(&child, &cache, cycles, CYCLES_PER_TICK);
+        }
+        else if (round / 3 == 2 && jit != NULL)
+        {
+            chip8_run_jit(&child, jit, cycles, CYCLES_PER_TICK);
+        }
+        else
+        {
+            chip8_run(&child, cycles, CYCLES_PER_TICK);
+        }
+        if (!same_state(&child, &copy))
+        {
+            fail("forks", program, "a child runs differently from a copy of its parent");
+            return;
+        }
+
+        // the child is left alone while a grandchild forks from it
+        struct Chip8 grandchild;
+        chip8_fork(&grandchild, &child);
+        chip8_run_cached(&grandchild, &cache, 2000, CYCLES_PER_TICK);
+        chip8_run(&copy, 2000, CYCLES_PER_TICK);
+        if (!same_state(&grandchild, &copy))
+        {
+            fail("forks", program, "a grandchild runs differently from a copy of its parent");
+            return;
+        }
+        chip8_rollback(&grandchild, &child);
+        if (!same_state(&grandchild, &child))
+        {
+            fail("forks", program, "a rolled back grandchild differs from its parent");
+            return;
+        }
+        chip8_rollback(&child, &parent);
+        if (!same_state(&child, &parent))
+        {
+            fail("forks", program, "a rolled back child differs from its parent");
+            return;
+        }
+    }
+
+    chip8_save_state(&parent, after, sizeof(after));
+    if (memcmp(before, after, sizeof(before)) != 0)
+    {
+        fail("forks", program, "running a child changed its parent");
+    }
+}
+
+// runs count frames and pushes each, every fifth one paused so the ring
+// repeats the frame before
+static void record_frames(struct Chip8Rewind *rewind, struct Chip8 *chip8, uint32_t *frame, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++, (*frame)++)
+    {
+        if (*frame % 5 != 4)
+        {
+            chip8_run(chip8, 200, CYCLES_PER_TICK);
+            press_keys(chip8, *frame);
+        }
+        chip8_save_state(chip8, history[*frame], sizeof(history[*frame]));
+        chip8_rewind_push(rewind, chip8);
+    }
+}
+
+// steps back up to count frames, each has to load exactly the state that
+// was pushed as the frame before
+static bool step_frames(struct Chip8Rewind *rewind, struct Chip8 *chip8, uint32_t *frame, uint32_t count)
+{
+    static uint8_t state[CHIP8_STATE_SIZE];
+
+    for (uint32_t i = 0; i < count && chip8_rewind_step(rewind, chip8); i++)
+    {
+        (*frame)--;
+        chip8_save_state(chip8, state, sizeof(state));
+        if (memcmp(state, history[*frame - 1], sizeof(state)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// records, steps back, records a new branch over the old frames and steps
+// back as far as the ring goes. once in a ring roomy enough for all of
+// it, once in the smallest ring, which keeps dropping its oldest frames
+static void check_rewind(const struct Program *program)
+{
+    static const struct
+    {
+        size_t capacity;
+        uint32_t keyframe_interval;
+    } rings[] = {
+        {REWIND_FRAMES * CHIP8_STATE_SIZE, 8},
+        {0, 4},
+    };
+
+    for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+    {
+        struct Chip8Rewind *rewind = chip8_rewind_create(rings[i].capacity, rings[i].keyframe_interval);
+        if (rewind == NULL)
+        {
+            fail("rewind", program, chip8_strerror(CHIP8_ERR_NO_MEMORY));
+            return;
+        }
+
+        struct Chip8 chip8 = program->machine;
+        chip8_seed(&chip8, 5);
+        uint32_t frame = 0;
+
+        checks++;
+        record_frames(rewind, &chip8, &frame, 32);
+        bool same = step_frames(rewind, &chip8, &frame, 20);
+        record_frames(rewind, &chip8, &frame, 16);
+        same = same && step_frames(rewind, &chip8, &frame, REWIND_FRAMES);
+        if (!same || chip8_rewind_frames(rewind) != 1)
+        {
+            fail("rewind", program, "stepping back loads a different state than was pushed");
+        }
+        chip8_rewind_destroy(rewind);
+    }
+}
+
+// a session played the way a frontend plays it, on the block cache with
+// keys, timer ticks and a save state loaded twice along the way, is
+// recorded and has to replay through the interpreter to the same machine
+// after the same number of cycles
+static void check_movies(const struct Program *program)
+{
+    static uint8_t state[CHIP8_STATE_SIZE];
+
+    struct Chip8 chip8 = program->machine;
+    chip8_seed(&chip8, 9);
+    chip8_cache_reset(&cache);
+
+    checks++;
+    struct Chip8Recorder recorder;
+    int error = chip8_record_start(&recorder, MOVIE_FILE, &chip8);
+    if (error != CHIP8_OK)
+    {
+        fail("movies", program, chip8_strerror(error));
+        return;
+    }
+
+    uint64_t cycle = 0;
+    for (uint32_t frame = 0; frame < 600; frame++)
+    {
+        cycle += chip8_run_cached(&chip8, &cache, CYCLES_PER_TICK, 0);
+        if (frame % 7 == 0)
+        {
+            int key = frame * 5 % 16;
+            bool pressed = frame % 2 == 0;
+            handle_keypres(&chip8, key, pressed);
+            chip8_record_key(&recorder, cycle, key, pressed);
+        }
+        if (frame == 150)
+        {
+            chip8_save_state(&chip8, state, sizeof(state));
+        }
+        if (frame == 300 || frame == 450)
+        {
+            chip8_load_state(&chip8, state, sizeof(state));
+            chip8_record_state(&recorder, cycle, &chip8);
+        }
+        chip8_tick_timers(&chip8);
+        chip8_record_tick(&recorder, cycle);
+    }
+
+    error = chip8_record_stop(&recorder, cycle);
+    struct Chip8 replayed;
+    uint64_t cycles;
+    if (error == CHIP8_OK)
+    {
+        error = chip8_replay(MOVIE_FILE, &replayed, &cycles);
+    }
+    remove(MOVIE_FILE);
+    if (error != CHIP8_OK)
+    {
+        fail("movies", program, chip8_strerror(error));
+    }
+    else if (cycles != cycle || !same_state(&chip8, &replayed))
+    {
+        fail("movies", program, "the replay ends in a different state");
+    }
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(const struct Program *program);
+} all_checks[] = {
+    {"backends", check_backends},
+    {"snapshots", check_snapshots},
+    {"forks", check_forks},
+    {"rewind", check_rewind},
+    {"movies", check_movies},
+};
+
+static void add_program(const char *name, const uint8_t *code, size_t size)
+{
+    struct Program *program = &programs[program_count++];
+    program->name = name;
+    initialize_chip8(&program->machine);
+    load_program_from_buffer(code, size, &program->machine);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc - 1 + sizeof(builtin_programs) / sizeof(builtin_programs[0]) > MAX_PROGRAMS)
+    {
+        printf("usage: %s [rom...], at most %d roms\n", argv[0], MAX_PROGRAMS);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        uint8_t code[CHIP8_PROGRAM_MAX];
+        size_t size;
+        int error = chip8_read_program(argv[i], code, &size);
+        if (error != CHIP8_OK)
+        {
+            printf("Error: %s %s\n", chip8_strerror(error), argv[i]);
+            return 1;
+        }
+        add_program(argv[i], code, size);
+    }
+    for (size_t i = 0; i < sizeof(builtin_programs) / sizeof(builtin_programs[0]); i++)
+    {
+        add_program(builtin_programs[i].name, builtin_programs[i].code, builtin_programs[i].size);
+    }
+
+    // without a native backend the jit half of the backend check is skipped
+    jit = chip8_jit_create();
+
+    for (size_t i = 0; i < sizeof(all_checks) / sizeof(all_checks[0]); i++)
+    {
+        int failed = failures;
+        for (int j = 0; j < program_count; j++)
+        {
+            all_checks[i].run(&programs[j]);
+        }
+        printf("%-10s %s\n", all_checks[i].name, failures == failed ? "ok" : "FAILED");
+    }
+
+    chip8_jit_destroy(jit);
+    printf("total: programs=%d checks=%d failed=%d\n", program_count, checks, failures);
+    return failures == 0 ? 0 : 1;
+}
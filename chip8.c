@@ -0,0 +1,1760 @@
+//
+//  chip8.c
+//  first c++ project
+//
+
+#include "chip8.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void build_decode_table(void);
+
+// all of memory and the screen are about to be replaced, so every page is
+// the machine's own. were it a forked child, a rollback hands them all back
+static void own_all_pages(struct Chip8 *chip8)
+{
+    memset(chip8->shared_memory, 0, sizeof(chip8->shared_memory));
+    memset(chip8->shared_gfx, 0, sizeof(chip8->shared_gfx));
+    memset(chip8->owned_memory, 0, sizeof(chip8->owned_memory));
+    for (uint32_t page = 0; page < CHIP8_MEMORY_PAGES; page++)
+    {
+        chip8->owned_memory[page / 64] |= 1ULL << (page % 64);
+    }
+    chip8->owned_gfx = (1u << CHIP8_GFX_PAGES) - 1;
+}
+
+void initialize_chip8(struct Chip8 *chip8)
+{
+    build_decode_table();
+
+    chip8->pc = PROGRAM_START;
+    chip8->opcode = 0;
+    chip8->I = 0;
+    chip8->sp = 0;
+    chip8->delay_timer = 0;
+    chip8->sound_timer = 0;
+    // a plain square wave until a rom loads its own pattern
+    memset(chip8->audio_pattern, 0xF0, sizeof(chip8->audio_pattern));
+    chip8->pitch = 64;
+    chip8->quirks = CHIP8_QUIRKS_DEFAULT;
+    chip8->vblank = false;
+    chip8->unknown_opcode = 0;
+    chip8->diag = NULL;
+    chip8_seed(chip8, 0);
+#ifdef CHIP8_PROFILE
+    chip8->profile = NULL;
+#endif
+
+    for (int i = 0; i < 16; i++)
+    {
+        chip8->v_register[i] = 0;
+        chip8->stack[i] = 0;
+        chip8->key[i] = 0;
+    }
+
+    own_all_pages(chip8);
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+    chip8->dirty_rows = ~0ULL;
+    chip8->hires = false;
+    chip8->planes = 1;
+    memset(chip8->flags, 0, sizeof(chip8->flags));
+
+    for (int i = 0; i < CHIP8_MEMORY_SIZE; i++)
+    {
+        chip8->memory[i] = 0;
+    }
+
+    uint8_t chip8_fontset[80] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+
+    for (int i = 0; i < 80; i++)
+    {
+        chip8->memory[FONTSET_START + i] = chip8_fontset[i];
+    }
+
+    uint8_t chip8_big_fontset[160] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    memcpy(&chip8->memory[BIG_FONTSET_START], chip8_big_fontset, sizeof(chip8_big_fontset));
+
+    chip8->written_pages = ~0ULL;
+}
+
+void chip8_seed(struct Chip8 *chip8, uint32_t seed)
+{
+    // xorshift gets stuck on a zero state
+    chip8->rng_state = seed * 0x9E3779B9u ^ 0x6D2B79F5u;
+    if (chip8->rng_state == 0)
+    {
+        chip8->rng_state = 1;
+    }
+}
+
+static uint8_t chip8_random(struct Chip8 *chip8)
+{
+    uint32_t x = chip8->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng_state = x;
+    return x >> 24;
+}
+
+void chip8_diag_init(struct Chip8Diag *diag)
+{
+    atomic_init(&diag->head, 0);
+    atomic_init(&diag->tail, 0);
+    atomic_init(&diag->dropped, 0);
+    diag->last.count = 0;
+}
+
+static void diag_publish(struct Chip8Diag *diag, const struct Chip8DiagEvent *event)
+{
+    unsigned head = atomic_load_explicit(&diag->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&diag->tail, memory_order_acquire);
+
+    if (head - tail >= CHIP8_DIAG_EVENTS)
+    {
+        atomic_fetch_add_explicit(&diag->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    diag->events[head % CHIP8_DIAG_EVENTS] = *event;
+    atomic_store_explicit(&diag->head, head + 1, memory_order_release);
+}
+
+// only reached on the rare paths, never for a normal instruction
+static void diag_post(struct Chip8 *chip8, uint8_t level, uint8_t code, uint16_t opcode)
+{
+    struct Chip8Diag *diag = chip8->diag;
+    if (diag == NULL)
+    {
+        return;
+    }
+
+    struct Chip8DiagEvent *last = &diag->last;
+    if (last->count != 0 && last->code == code && last->pc == chip8->pc && last->opcode == opcode)
+    {
+        last->count++;
+        if ((last->count & (last->count - 1)) != 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        last->level = level;
+        last->code = code;
+        last->pc = chip8->pc;
+        last->opcode = opcode;
+        last->count = 1;
+    }
+
+    diag_publish(diag, last);
+}
+
+bool chip8_diag_read(struct Chip8Diag *diag, struct Chip8DiagEvent *event)
+{
+    unsigned tail = atomic_load_explicit(&diag->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&diag->head, memory_order_acquire);
+
+    if (tail == head)
+    {
+        return false;
+    }
+
+    *event = diag->events[tail % CHIP8_DIAG_EVENTS];
+    atomic_store_explicit(&diag->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+uint32_t chip8_diag_dropped(struct Chip8Diag *diag)
+{
+    return atomic_exchange_explicit(&diag->dropped, 0, memory_order_relaxed);
+}
+
+const char *chip8_diag_message(int code)
+{
+    switch (code)
+    {
+    case CHIP8_DIAG_UNKNOWN_OPCODE:
+        return "Unknown opcode";
+    case CHIP8_DIAG_WAIT_KEY:
+        return "Waiting for a key";
+    case CHIP8_DIAG_STACK_OVERFLOW:
+        return "Stack overflow";
+    case CHIP8_DIAG_STACK_UNDERFLOW:
+        return "Stack underflow";
+    case CHIP8_DIAG_MEMORY_WRAP:
+        return "Memory access wrapped around";
+    default:
+        return "Unknown diagnostic";
+    }
+}
+
+// the first store to a page a forked child still shares with its parent
+// takes a copy of it
+static inline void own_memory_page(struct Chip8 *chip8, uint32_t page)
+{
+    if (chip8->shared_memory[page] != NULL)
+    {
+        memcpy(&chip8->memory[page << CHIP8_FORK_PAGE_SHIFT], chip8->shared_memory[page], CHIP8_FORK_PAGE_SIZE);
+        chip8->shared_memory[page] = NULL;
+        chip8->owned_memory[page / 64] |= 1ULL << (page % 64);
+    }
+}
+
+// tells the block cache which of its 64 pages of memory changed. an
+// address past the end lands on the page it wraps to
+static inline void mark_changed(struct Chip8 *chip8, uint32_t address, uint32_t length)
+{
+    for (uint32_t page = address >> CHIP8_PAGE_SHIFT; page <= (address + length - 1) >> CHIP8_PAGE_SHIFT; page++)
+    {
+        chip8->written_pages |= 1ULL << (page & 63);
+    }
+}
+
+// called before every store to memory, the pages it lands on become the
+// machine's own
+static inline void mark_written(struct Chip8 *chip8, uint32_t address, uint32_t length)
+{
+    mark_changed(chip8, address, length);
+    for (uint32_t page = address >> CHIP8_FORK_PAGE_SHIFT; page <= (address + length - 1) >> CHIP8_FORK_PAGE_SHIFT; page++)
+    {
+        own_memory_page(chip8, page & (CHIP8_MEMORY_PAGES - 1));
+    }
+}
+
+// a page is shared exactly while its owned_memory bit is clear. nothing a
+// run does shares one again, so a machine holding all of its memory when
+// the run starts reads it through read_own_word until the run ends
+static inline bool memory_owned(const struct Chip8 *chip8)
+{
+    for (uint32_t page = 0; page < CHIP8_MEMORY_PAGES; page += 64)
+    {
+        uint32_t count = CHIP8_MEMORY_PAGES - page < 64 ? CHIP8_MEMORY_PAGES - page : 64;
+        if (chip8->owned_memory[page / 64] != ~0ULL >> (64 - count))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// memory is only ever indexed through the mask, so whatever I and pc
+// hold a rom can't reach outside the array
+static inline uint16_t read_own_word(const struct Chip8 *chip8, uint32_t address)
+{
+    return chip8->memory[address & CHIP8_MEMORY_MASK] << 8 | chip8->memory[(address + 1) & CHIP8_MEMORY_MASK];
+}
+
+static inline uint16_t read_word(const struct Chip8 *chip8, uint32_t address)
+{
+    const uint8_t *page = chip8_memory_page(chip8, address);
+    uint32_t offset = address & (CHIP8_FORK_PAGE_SIZE - 1);
+    if (offset == CHIP8_FORK_PAGE_SIZE - 1)
+    {
+        return page[offset] << 8 | chip8_peek(chip8, address + 1);
+    }
+    return page[offset] << 8 | page[offset + 1];
+}
+
+// an access through I that runs past the end still goes ahead on the
+// wrapped addresses, this only tells whoever is watching that a rom did it
+static inline void check_wrap(struct Chip8 *chip8, uint32_t address, uint32_t length, uint16_t opcode)
+{
+    if (address + length > CHIP8_MEMORY_SIZE)
+    {
+        diag_post(chip8, CHIP8_DIAG_WARNING, CHIP8_DIAG_MEMORY_WRAP, opcode);
+    }
+}
+
+// FX65 and friends copy a plain run of memory unless it wraps or crosses
+// a page, a forked child's pages may be anywhere
+static inline void copy_from_memory(struct Chip8 *chip8, uint8_t *to, uint32_t address, uint32_t length, uint16_t opcode)
+{
+    uint32_t first = address & (CHIP8_FORK_PAGE_SIZE - 1);
+    if (first + length <= CHIP8_FORK_PAGE_SIZE && address + length <= CHIP8_MEMORY_SIZE)
+    {
+        memcpy(to, chip8_memory_page(chip8, address) + first, length);
+        return;
+    }
+
+    check_wrap(chip8, address, length, opcode);
+    while (length > 0)
+    {
+        uint32_t offset = address & (CHIP8_FORK_PAGE_SIZE - 1);
+        uint32_t chunk = CHIP8_FORK_PAGE_SIZE - offset < length ? CHIP8_FORK_PAGE_SIZE - offset : length;
+        memcpy(to, chip8_memory_page(chip8, address) + offset, chunk);
+        to += chunk;
+        address += chunk;
+        length -= chunk;
+    }
+}
+
+// FX55 and FX33 store a plain run of memory unless it wraps, mark_written
+// has made every page it touches the machine's own
+static inline void copy_to_memory(struct Chip8 *chip8, uint32_t address, const uint8_t *from, uint32_t length, uint16_t opcode)
+{
+    mark_written(chip8, address, length);
+    if (address + length <= CHIP8_MEMORY_SIZE)
+    {
+        memcpy(&chip8->memory[address], from, length);
+        return;
+    }
+
+    check_wrap(chip8, address, length, opcode);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        chip8->memory[(address + i) & CHIP8_MEMORY_MASK] = from[i];
+    }
+}
+
+// XO-CHIP: a taken skip steps over the whole of a 4 byte F000 NNNN
+static inline void skip_if(struct Chip8 *chip8, bool condition)
+{
+    chip8->pc += condition ? (read_word(chip8, chip8->pc + 2) == 0xF000 ? 6 : 4) : 2;
+}
+
+int load_program_from_buffer(const uint8_t *program, size_t size, struct Chip8 *chip8)
+{
+    if (size > CHIP8_PROGRAM_MAX)
+    {
+        return CHIP8_ERR_TOO_LARGE;
+    }
+
+    if (size > 0)
+    {
+        mark_written(chip8, PROGRAM_START, size);
+    }
+    memcpy(&chip8->memory[PROGRAM_START], program, size);
+    return CHIP8_OK;
+}
+
+// one read of up to a byte more than fits, so an oversized file shows
+// without seeking to its end first
+int chip8_read_program(const char *filename, uint8_t program[CHIP8_PROGRAM_MAX], size_t *size)
+{
+    FILE *file = fopen(filename, "rb");
+
+    if (file == NULL)
+    {
+        return CHIP8_ERR_OPEN;
+    }
+
+    *size = fread(program, 1, CHIP8_PROGRAM_MAX, file);
+    bool too_large = *size == CHIP8_PROGRAM_MAX && fgetc(file) != EOF;
+    bool failed = ferror(file) != 0;
+    fclose(file);
+
+    if (too_large)
+    {
+        return CHIP8_ERR_TOO_LARGE;
+    }
+    return failed ? CHIP8_ERR_READ : CHIP8_OK;
+}
+
+int load_program_to_memory(const char *filename, struct Chip8 *chip8)
+{
+    uint8_t program[CHIP8_PROGRAM_MAX];
+    size_t size;
+
+    int error = chip8_read_program(filename, program, &size);
+    if (error != CHIP8_OK)
+    {
+        return error;
+    }
+    return load_program_from_buffer(program, size, chip8);
+}
+
+const char *chip8_strerror(int error)
+{
+    switch (error)
+    {
+    case CHIP8_OK:
+        return "Success";
+    case CHIP8_ERR_OPEN:
+        return "Couldn't open file";
+    case CHIP8_ERR_TOO_LARGE:
+        return "File size too large";
+    case CHIP8_ERR_NO_MEMORY:
+        return "Couldn't allocate memory for buffer";
+    case CHIP8_ERR_READ:
+        return "Couldn't read file";
+    case CHIP8_ERR_BAD_STATE:
+        return "Not a valid save state";
+    case CHIP8_ERR_WRITE:
+        return "Couldn't write file";
+    case CHIP8_ERR_BAD_MOVIE:
+        return "Not a valid movie file";
+    case CHIP8_ERR_BAD_CORPUS:
+        return "Not a valid rom archive";
+    case CHIP8_ERR_NO_JIT:
+        return "No jit on this target";
+    default:
+        return "Unknown error";
+    }
+}
+
+// every instruction the cpu knows, in the order of the handler table.
+// Q marks the ones a quirk profile changes, chip8-quirks.inc has those
+#define CHIP8_OPS(X, Q) \
+    X(unknown)       \
+    X(cls)           \
+    X(ret)           \
+    X(jp)            \
+    X(call)          \
+    X(se_vx_nn)      \
+    X(sne_vx_nn)     \
+    X(se_vx_vy)      \
+    X(ld_vx_nn)      \
+    X(add_vx_nn)     \
+    X(ld_vx_vy)      \
+    Q(or_vx_vy)      \
+    Q(and_vx_vy)     \
+    Q(xor_vx_vy)     \
+    X(add_vx_vy)     \
+    X(sub_vx_vy)     \
+    Q(shr_vx)        \
+    X(subn_vx_vy)    \
+    Q(shl_vx)        \
+    X(sne_vx_vy)     \
+    X(ld_i_nnn)      \
+    X(ld_i_long)     \
+    Q(jp_v0_nnn)     \
+    X(rnd_vx_nn)     \
+    Q(drw)           \
+    X(skp_vx)        \
+    X(sknp_vx)       \
+    X(ld_vx_dt)      \
+    X(ld_vx_k)       \
+    X(ld_dt_vx)      \
+    X(ld_st_vx)      \
+    X(add_i_vx)      \
+    X(ld_f_vx)       \
+    X(ld_b_vx)       \
+    Q(ld_i_vx)       \
+    Q(ld_vx_i)       \
+    X(ld_audio_i)    \
+    X(ld_pitch_vx)   \
+    X(scd)           \
+    X(scu)           \
+    X(scr)           \
+    X(scl)           \
+    X(exit)          \
+    X(low)           \
+    X(high)          \
+    X(plane)         \
+    X(ld_hf_vx)      \
+    X(ld_r_vx)       \
+    X(ld_vx_r)
+
+#define OP_ENUM(name) OP_##name,
+enum Chip8Op
+{
+    CHIP8_OPS(OP_ENUM, OP_ENUM)
+    OP_COUNT
+};
+#undef OP_ENUM
+
+// operands, pulled out of the opcode once at the top of each handler
+#define OP_X(opcode) (((opcode) >> 8) & 0x000F)
+#define OP_Y(opcode) (((opcode) >> 4) & 0x000F)
+#define OP_N(opcode) ((opcode) & 0x000F)
+#define OP_NN(opcode) ((opcode) & 0x00FF)
+#define OP_NNN(opcode) ((opcode) & 0x0FFF)
+
+static inline void op_unknown(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->unknown_opcode = opcode;
+    diag_post(chip8, CHIP8_DIAG_WARNING, CHIP8_DIAG_UNKNOWN_OPCODE, opcode);
+    chip8->pc += 2;
+}
+
+// every display change but drawing goes through here, it repaints the
+// whole screen
+static void changed_screen(struct Chip8 *chip8)
+{
+    chip8->dirty_rows = ~0ULL;
+}
+
+// the framebuffer row to store to, after taking a copy of its page if a
+// forked child still shares it
+static inline uint64_t *gfx_line(struct Chip8 *chip8, int plane, int half, int y)
+{
+    int page = ((plane * 2 + half) * SCREEN_HIRES_HEIGHT + y) / CHIP8_GFX_PAGE_ROWS;
+    if (chip8->shared_gfx[page] != NULL)
+    {
+        memcpy(&chip8->gfx[plane][half][y & ~(CHIP8_GFX_PAGE_ROWS - 1)], chip8->shared_gfx[page], CHIP8_FORK_PAGE_SIZE);
+        chip8->shared_gfx[page] = NULL;
+        chip8->owned_gfx |= 1u << page;
+    }
+    return &chip8->gfx[plane][half][y];
+}
+
+// a page is shared exactly while its owned_gfx bit is clear, so with
+// every bit set the rows can be stored to without gfx_line
+static inline bool gfx_owned(const struct Chip8 *chip8)
+{
+    return chip8->owned_gfx == (1u << CHIP8_GFX_PAGES) - 1;
+}
+
+// the rows from y on that a sprite draws to, wrapping at the bottom
+static void own_rows(struct Chip8 *chip8, int plane, int halves, int y, int rows, int height)
+{
+    for (int row = 0; row < rows; row++)
+    {
+        for (int half = 0; half < halves; half++)
+        {
+            gfx_line(chip8, plane, half, (y + row) & (height - 1));
+        }
+    }
+}
+
+// scrolling reads and writes the top height rows of both halves
+static void own_plane(struct Chip8 *chip8, int plane, int height)
+{
+    for (int half = 0; half < 2; half++)
+    {
+        for (int y = 0; y < height; y += CHIP8_GFX_PAGE_ROWS)
+        {
+            gfx_line(chip8, plane, half, y);
+        }
+    }
+}
+
+static inline void op_cls(struct Chip8 *chip8, uint16_t opcode)
+{
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if (!(chip8->planes >> plane & 1))
+        {
+            continue;
+        }
+
+        // in low res everything outside the left half's top rows is zero
+        // already. either way only whole pages are cleared, so a forked
+        // child takes them over without copying
+        int first = plane * (CHIP8_GFX_PAGES / CHIP8_PLANES);
+        if (chip8->hires)
+        {
+            memset(chip8->gfx[plane], 0, sizeof(chip8->gfx[plane]));
+            memset(&chip8->shared_gfx[first], 0, CHIP8_GFX_PAGES / CHIP8_PLANES * sizeof(chip8->shared_gfx[0]));
+            chip8->owned_gfx |= ((1u << CHIP8_GFX_PAGES / CHIP8_PLANES) - 1) << first;
+        }
+        else
+        {
+            memset(chip8->gfx[plane][0], 0, SCREEN_HEIGHT * sizeof(uint64_t));
+            chip8->shared_gfx[first] = NULL;
+            chip8->owned_gfx |= 1u << first;
+        }
+    }
+    changed_screen(chip8);
+    chip8->pc += 2;
+}
+
+// scrolling moves whole rows, or shifts them as a pair of words. low res
+// scrolls by low res pixels
+static inline void op_scd(struct Chip8 *chip8, uint16_t opcode)
+{
+    int height = chip8_screen_height(chip8);
+    int n = OP_N(opcode);
+
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if (chip8->planes >> plane & 1)
+        {
+            own_plane(chip8, plane, height);
+            for (int half = 0; half < 2; half++)
+            {
+                uint64_t *rows = chip8->gfx[plane][half];
+                memmove(&rows[n], rows, (height - n) * sizeof(uint64_t));
+                memset(rows, 0, n * sizeof(uint64_t));
+            }
+        }
+    }
+    changed_screen(chip8);
+    chip8->pc += 2;
+}
+
+static inline void op_scu(struct Chip8 *chip8, uint16_t opcode)
+{
+    int height = chip8_screen_height(chip8);
+    int n = OP_N(opcode);
+
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if (chip8->planes >> plane & 1)
+        {
+            own_plane(chip8, plane, height);
+            for (int half = 0; half < 2; half++)
+            {
+                uint64_t *rows = chip8->gfx[plane][half];
+                memmove(rows, &rows[n], (height - n) * sizeof(uint64_t));
+                memset(&rows[height - n], 0, n * sizeof(uint64_t));
+            }
+        }
+    }
+    changed_screen(chip8);
+    chip8->pc += 2;
+}
+
+// in low res the second word is always zero and the pixels shifted out of
+// the first one are gone, like they should be
+static inline void op_scr(struct Chip8 *chip8, uint16_t opcode)
+{
+    int height = chip8_screen_height(chip8);
+    uint64_t keep = chip8->hires ? ~0ULL : 0;
+
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if (chip8->planes >> plane & 1)
+        {
+            own_plane(chip8, plane, height);
+            for (int y = 0; y < height; y++)
+            {
+                uint64_t *left = &chip8->gfx[plane][0][y];
+                uint64_t *right = &chip8->gfx[plane][1][y];
+                *right = (*right >> 4 | *left << 60) & keep;
+                *left >>= 4;
+            }
+        }
+    }
+    changed_screen(chip8);
+    chip8->pc += 2;
+}
+
+static inline void op_scl(struct Chip8 *chip8, uint16_t opcode)
+{
+    int height = chip8_screen_height(chip8);
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if (chip8->planes >> plane & 1)
+        {
+            own_plane(chip8, plane, height);
+            for (int y = 0; y < height; y++)
+            {
+                uint64_t *left = &chip8->gfx[plane][0][y];
+                uint64_t *right = &chip8->gfx[plane][1][y];
+                *left = *left << 4 | *right >> 60;
+                *right <<= 4;
+            }
+        }
+    }
+    changed_screen(chip8);
+    chip8->pc += 2;
+}
+
+// the pc stays put, so the cpu is parked from here on
+static inline void op_exit(struct Chip8 *chip8, uint16_t opcode)
+{
+}
+
+// switching resolution clears every plane, like XO-CHIP does
+static void set_hires(struct Chip8 *chip8, bool hires)
+{
+    chip8->hires = hires;
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+    memset(chip8->shared_gfx, 0, sizeof(chip8->shared_gfx));
+    chip8->owned_gfx = (1u << CHIP8_GFX_PAGES) - 1;
+    changed_screen(chip8);
+}
+
+static inline void op_low(struct Chip8 *chip8, uint16_t opcode)
+{
+    set_hires(chip8, false);
+    chip8->pc += 2;
+}
+
+static inline void op_high(struct Chip8 *chip8, uint16_t opcode)
+{
+    set_hires(chip8, true);
+    chip8->pc += 2;
+}
+
+static inline void op_plane(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->planes = OP_X(opcode) & ((1 << CHIP8_PLANES) - 1);
+    chip8->pc += 2;
+}
+
+// a stack that runs over or under wraps around instead of leaving the
+// array, the rom gets the wrong return address and a report
+static inline void op_ret(struct Chip8 *chip8, uint16_t opcode)
+{
+    if (chip8->sp == 0)
+    {
+        diag_post(chip8, CHIP8_DIAG_WARNING, CHIP8_DIAG_STACK_UNDERFLOW, opcode);
+        chip8->sp = 16;
+    }
+    chip8->sp--;
+    chip8->pc = chip8->stack[chip8->sp] + 2;
+}
+
+static inline void op_jp(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->pc = OP_NNN(opcode);
+}
+
+static inline void op_call(struct Chip8 *chip8, uint16_t opcode)
+{
+    if (chip8->sp == 16)
+    {
+        diag_post(chip8, CHIP8_DIAG_WARNING, CHIP8_DIAG_STACK_OVERFLOW, opcode);
+        chip8->sp = 0;
+    }
+    chip8->stack[chip8->sp] = chip8->pc;
+    chip8->sp++;
+    chip8->pc = OP_NNN(opcode);
+}
+
+static inline void op_se_vx_nn(struct Chip8 *chip8, uint16_t opcode)
+{
+    skip_if(chip8, chip8->v_register[OP_X(opcode)] == OP_NN(opcode));
+}
+
+static inline void op_sne_vx_nn(struct Chip8 *chip8, uint16_t opcode)
+{
+    skip_if(chip8, chip8->v_register[OP_X(opcode)] != OP_NN(opcode));
+}
+
+static inline void op_se_vx_vy(struct Chip8 *chip8, uint16_t opcode)
+{
+    skip_if(chip8, chip8->v_register[OP_X(opcode)] == chip8->v_register[OP_Y(opcode)]);
+}
+
+static inline void op_ld_vx_nn(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->v_register[OP_X(opcode)] = OP_NN(opcode);
+    chip8->pc += 2;
+}
+
+static inline void op_add_vx_nn(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->v_register[OP_X(opcode)] += OP_NN(opcode);
+    chip8->pc += 2;
+}
+
+static inline void op_ld_vx_vy(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->v_register[OP_X(opcode)] = chip8->v_register[OP_Y(opcode)];
+    chip8->pc += 2;
+}
+
+// 8XY4 to 8XYE write the result first and VF last, so with X = F the
+// flag is what VF ends up holding. the shifts in chip8-quirks.inc and
+// the jit keep to the same order
+static inline void op_add_vx_vy(struct Chip8 *chip8, uint16_t opcode)
+{
+    unsigned short x = OP_X(opcode);
+    unsigned short sum = chip8->v_register[x] + chip8->v_register[OP_Y(opcode)];
+
+    chip8->v_register[x] = sum & 0x00FF;
+    chip8->v_register[0xF] = sum > 0xFF;
+    chip8->pc += 2;
+}
+
+static inline void op_sub_vx_vy(struct Chip8 *chip8, uint16_t opcode)
+{
+    uint8_t vx = chip8->v_register[OP_X(opcode)];
+    uint8_t vy = chip8->v_register[OP_Y(opcode)];
+
+    // VF is set when nothing was borrowed
+    chip8->v_register[OP_X(opcode)] = vx - vy;
+    chip8->v_register[0xF] = vx >= vy;
+    chip8->pc += 2;
+}
+
+static inline void op_subn_vx_vy(struct Chip8 *chip8, uint16_t opcode)
+{
+    uint8_t vx = chip8->v_register[OP_X(opcode)];
+    uint8_t vy = chip8->v_register[OP_Y(opcode)];
+
+    chip8->v_register[OP_X(opcode)] = vy - vx;
+    chip8->v_register[0xF] = vy >= vx;
+    chip8->pc += 2;
+}
+
+static inline void op_sne_vx_vy(struct Chip8 *chip8, uint16_t opcode)
+{
+    skip_if(chip8, chip8->v_register[OP_X(opcode)] != chip8->v_register[OP_Y(opcode)]);
+}
+
+static inline void op_ld_i_nnn(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->I = OP_NNN(opcode);
+    chip8->pc += 2;
+}
+
+// XO-CHIP F000 NNNN, the address is the word after the instruction
+static inline void op_ld_i_long(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->I = read_word(chip8, chip8->pc + 2);
+    chip8->pc += 4;
+}
+
+static inline void op_rnd_vx_nn(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->v_register[OP_X(opcode)] = chip8_random(chip8) & OP_NN(opcode);
+    chip8->pc += 2;
+}
+
+// the sprite row lined up with the left edge of the screen
+static inline uint64_t sprite_row(const uint8_t *data, int row, bool wide)
+{
+    return wide ? (uint64_t)(data[row * 2] << 8 | data[row * 2 + 1]) << 48 : (uint64_t)data[row] << 56;
+}
+
+static inline void op_skp_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    skip_if(chip8, chip8->key[chip8->v_register[OP_X(opcode)] & 0xF] != 0);
+}
+
+static inline void op_sknp_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    skip_if(chip8, chip8->key[chip8->v_register[OP_X(opcode)] & 0xF] == 0);
+}
+
+static inline void op_ld_vx_dt(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->v_register[OP_X(opcode)] = chip8->delay_timer;
+    chip8->pc += 2;
+}
+
+static inline void op_ld_vx_k(struct Chip8 *chip8, uint16_t opcode)
+{
+    unsigned short x = OP_X(opcode);
+    bool key_pressed = false;
+
+    for (int i = 0; i < 16; i++)
+    {
+        if (chip8->key[i] != 0)
+        {
+            chip8->v_register[x] = i;
+            key_pressed = true;
+        }
+    }
+
+    // no key yet, run this instruction again next cycle
+    if (key_pressed)
+    {
+        chip8->pc += 2;
+    }
+    else
+    {
+        diag_post(chip8, CHIP8_DIAG_INFO, CHIP8_DIAG_WAIT_KEY, opcode);
+    }
+}
+
+static inline void op_ld_dt_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->delay_timer = chip8->v_register[OP_X(opcode)];
+    chip8->pc += 2;
+}
+
+static inline void op_ld_st_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->sound_timer = chip8->v_register[OP_X(opcode)];
+    chip8->pc += 2;
+}
+
+static inline void op_add_i_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->I += chip8->v_register[OP_X(opcode)];
+    chip8->pc += 2;
+}
+
+static inline void op_ld_f_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->I = FONTSET_START + (chip8->v_register[OP_X(opcode)] & 0xF) * 5;
+    chip8->pc += 2;
+}
+
+static inline void op_ld_b_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    uint8_t value = chip8->v_register[OP_X(opcode)];
+    uint8_t digits[3] = {value / 100, (value / 10) % 10, value % 10};
+
+    copy_to_memory(chip8, chip8->I, digits, sizeof(digits), opcode);
+    chip8->pc += 2;
+}
+
+static inline void op_ld_hf_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->I = BIG_FONTSET_START + (chip8->v_register[OP_X(opcode)] & 0xF) * 10;
+    chip8->pc += 2;
+}
+
+static inline void op_ld_r_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    memcpy(chip8->flags, chip8->v_register, OP_X(opcode) + 1);
+    chip8->pc += 2;
+}
+
+static inline void op_ld_vx_r(struct Chip8 *chip8, uint16_t opcode)
+{
+    memcpy(chip8->v_register, chip8->flags, OP_X(opcode) + 1);
+    chip8->pc += 2;
+}
+
+static inline void op_ld_audio_i(struct Chip8 *chip8, uint16_t opcode)
+{
+    copy_from_memory(chip8, chip8->audio_pattern, chip8->I, sizeof(chip8->audio_pattern), opcode);
+    chip8->pc += 2;
+}
+
+static inline void op_ld_pitch_vx(struct Chip8 *chip8, uint16_t opcode)
+{
+    chip8->pitch = chip8->v_register[OP_X(opcode)];
+    chip8->pc += 2;
+}
+
+// maps every possible 16 bit opcode straight to its handler, so the hot
+// path is one table load and a single jump instead of the nested switches
+static uint8_t decode_table[0x10000];
+static bool decode_table_ready = false;
+
+static uint8_t decode(uint16_t opcode)
+{
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+        if ((opcode & 0xFFF0) == 0x00C0)
+        {
+            return OP_scd;
+        }
+        if ((opcode & 0xFFF0) == 0x00D0)
+        {
+            return OP_scu;
+        }
+        switch (opcode & 0x00FF)
+        {
+        case 0x00E0:
+            return OP_cls;
+        case 0x00EE:
+            return OP_ret;
+        case 0x00FB:
+            return OP_scr;
+        case 0x00FC:
+            return OP_scl;
+        case 0x00FD:
+            return OP_exit;
+        case 0x00FE:
+            return OP_low;
+        case 0x00FF:
+            return OP_high;
+        default:
+            return OP_unknown;
+        }
+    case 0x1000:
+        return OP_jp;
+    case 0x2000:
+        return OP_call;
+    case 0x3000:
+        return OP_se_vx_nn;
+    case 0x4000:
+        return OP_sne_vx_nn;
+    case 0x5000:
+        return OP_se_vx_vy;
+    case 0x6000:
+        return OP_ld_vx_nn;
+    case 0x7000:
+        return OP_add_vx_nn;
+    case 0x8000:
+        switch (opcode & 0x000F)
+        {
+        case 0x0000:
+            return OP_ld_vx_vy;
+        case 0x0001:
+            return OP_or_vx_vy;
+        case 0x0002:
+            return OP_and_vx_vy;
+        case 0x0003:
+            return OP_xor_vx_vy;
+        case 0x0004:
+            return OP_add_vx_vy;
+        case 0x0005:
+            return OP_sub_vx_vy;
+        case 0x0006:
+            return OP_shr_vx;
+        case 0x0007:
+            return OP_subn_vx_vy;
+        case 0x000E:
+            return OP_shl_vx;
+        default:
+            return OP_unknown;
+        }
+    case 0x9000:
+        return OP_sne_vx_vy;
+    case 0xA000:
+        return OP_ld_i_nnn;
+    case 0xB000:
+        return OP_jp_v0_nnn;
+    case 0xC000:
+        return OP_rnd_vx_nn;
+    case 0xD000:
+        return OP_drw;
+    case 0xE000:
+        switch (opcode & 0x00FF)
+        {
+        case 0x009E:
+            return OP_skp_vx;
+        case 0x00A1:
+            return OP_sknp_vx;
+        default:
+            return OP_unknown;
+        }
+    default:
+        switch (opcode & 0x00FF)
+        {
+        case 0x0000:
+            return opcode == 0xF000 ? OP_ld_i_long : OP_unknown;
+        case 0x0001:
+            return OP_plane;
+        case 0x0002:
+            return opcode == 0xF002 ? OP_ld_audio_i : OP_unknown;
+        case 0x0007:
+            return OP_ld_vx_dt;
+        case 0x000A:
+            return OP_ld_vx_k;
+        case 0x0015:
+            return OP_ld_dt_vx;
+        case 0x0018:
+            return OP_ld_st_vx;
+        case 0x001E:
+            return OP_add_i_vx;
+        case 0x0029:
+            return OP_ld_f_vx;
+        case 0x0030:
+            return OP_ld_hf_vx;
+        case 0x0033:
+            return OP_ld_b_vx;
+        case 0x003A:
+            return OP_ld_pitch_vx;
+        case 0x0055:
+            return OP_ld_i_vx;
+        case 0x0065:
+            return OP_ld_vx_i;
+        case 0x0075:
+            return OP_ld_r_vx;
+        case 0x0085:
+            return OP_ld_vx_r;
+        default:
+            return OP_unknown;
+        }
+    }
+}
+
+// filled on the first initialize_chip8, before any worker threads start
+static void build_decode_table(void)
+{
+    if (decode_table_ready)
+    {
+        return;
+    }
+
+    for (uint32_t opcode = 0; opcode < 0x10000; opcode++)
+    {
+        decode_table[opcode] = decode(opcode);
+    }
+    decode_table_ready = true;
+}
+
+static inline uint16_t fetch(const struct Chip8 *chip8)
+{
+    return read_word(chip8, chip8->pc);
+}
+
+// run this in 60HZ
+bool chip8_tick_timers(struct Chip8 *chip8)
+{
+    chip8->vblank = true;
+
+    // if non zero
+    if (chip8->delay_timer > 0)
+    {
+        chip8->delay_timer--;
+    }
+
+    if (chip8->sound_timer > 0)
+    {
+        chip8->sound_timer--;
+        return true;
+    }
+
+    return false;
+}
+
+void handle_keypres(struct Chip8 *chip8, int index, bool pressed)
+{
+    chip8->key[index] = pressed ? 1 : 0;
+}
+
+bool chip8_is_halted(const struct Chip8 *chip8)
+{
+    return chip8_parks(fetch(chip8), chip8->pc);
+}
+
+bool chip8_waiting_for_key(const struct Chip8 *chip8)
+{
+    if ((fetch(chip8) & 0xF0FF) != 0xF00A)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        if (chip8->key[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// anything that always leaves straight line code, touches the display,
+// writes memory or can stall the pc closes a block. skips stay inside, a
+// taken one just leaves the block early
+static bool ends_block(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_se_vx_nn:
+    case OP_sne_vx_nn:
+    case OP_se_vx_vy:
+    case OP_sne_vx_vy:
+    case OP_skp_vx:
+    case OP_sknp_vx:
+    case OP_ld_vx_nn:
+    case OP_add_vx_nn:
+    case OP_ld_vx_vy:
+    case OP_or_vx_vy:
+    case OP_and_vx_vy:
+    case OP_xor_vx_vy:
+    case OP_add_vx_vy:
+    case OP_sub_vx_vy:
+    case OP_shr_vx:
+    case OP_subn_vx_vy:
+    case OP_shl_vx:
+    case OP_ld_i_nnn:
+    case OP_rnd_vx_nn:
+    case OP_ld_vx_dt:
+    case OP_ld_dt_vx:
+    case OP_ld_st_vx:
+    case OP_add_i_vx:
+    case OP_ld_f_vx:
+    case OP_ld_vx_i:
+    case OP_ld_audio_i:
+    case OP_ld_pitch_vx:
+    case OP_plane:
+    case OP_ld_hf_vx:
+    case OP_ld_r_vx:
+    case OP_ld_vx_r:
+        return false;
+    default:
+        return true;
+    }
+}
+
+void chip8_cache_reset(struct Chip8Cache *cache)
+{
+    memset(cache->block_at, 0, sizeof(cache->block_at));
+    cache->count = 0;
+}
+
+// cheaper than a reset when only a few blocks were ever decoded
+static void flush_blocks(struct Chip8Cache *cache)
+{
+    for (uint16_t i = 0; i < cache->count; i++)
+    {
+        cache->block_at[cache->blocks[i].pc] = 0;
+    }
+    cache->count = 0;
+}
+
+static void invalidate_written(struct Chip8 *chip8, struct Chip8Cache *cache)
+{
+    uint64_t written = chip8->written_pages;
+    chip8->written_pages = 0;
+
+    if (written == ~0ULL)
+    {
+        flush_blocks(cache);
+        return;
+    }
+
+    // dropped blocks keep their slot until the next flush
+    for (uint16_t i = 0; i < cache->count; i++)
+    {
+        struct Chip8Block *block = &cache->blocks[i];
+        if ((block->pages & written) != 0 && cache->block_at[block->pc] == i + 1)
+        {
+            cache->block_at[block->pc] = 0;
+        }
+    }
+}
+
+static struct Chip8Block *build_block(struct Chip8 *chip8, struct Chip8Cache *cache)
+{
+    if (cache->count == CHIP8_CACHE_BLOCKS)
+    {
+        flush_blocks(cache);
+    }
+
+    struct Chip8Block *block = &cache->blocks[cache->count++];
+    // wider than the pc, so a block running into the end of a 64 KB memory
+    // stops there instead of wrapping around to 0
+    uint32_t pc = chip8->pc;
+
+    block->pc = pc;
+    block->count = 0;
+
+    // the parking instruction is left out so the block stops right where
+    // chip8_run would see the halt
+    while (block->count < CHIP8_BLOCK_MAX && pc < sizeof(chip8->memory) - 1)
+    {
+        uint16_t opcode = read_word(chip8, pc);
+        if (chip8_parks(opcode, pc))
+        {
+            break;
+        }
+
+        uint8_t op = decode_table[opcode];
+        block->op[block->count] = op;
+        block->opcode[block->count] = opcode;
+        block->count++;
+        pc += 2;
+
+        if (ends_block(op))
+        {
+            break;
+        }
+    }
+
+    // a halt block still depends on the instruction it stopped at
+    uint32_t last = pc > block->pc ? pc - 1u : pc + 1u;
+    block->pages = 0;
+    for (uint32_t page = block->pc >> CHIP8_PAGE_SHIFT; page <= last >> CHIP8_PAGE_SHIFT; page++)
+    {
+        block->pages |= 1ULL << (page & 63);
+    }
+
+    cache->block_at[block->pc] = cache->count;
+    return block;
+}
+
+#define QUIRKS_ENTRY(id, name, vf_reset, shift_vy, memory, jump_vx, clip, display_wait) \
+    {name, vf_reset, shift_vy, memory, jump_vx, clip, display_wait},
+static const struct Chip8Quirks quirk_profiles[] = {CHIP8_QUIRK_PROFILES(QUIRKS_ENTRY)};
+#undef QUIRKS_ENTRY
+
+const struct Chip8Quirks *chip8_quirks(int profile)
+{
+    return profile >= 0 && profile < CHIP8_QUIRKS_COUNT ? &quirk_profiles[profile] : NULL;
+}
+
+int chip8_quirks_from_name(const char *name)
+{
+    for (int profile = 0; profile < CHIP8_QUIRKS_COUNT; profile++)
+    {
+        if (strcmp(quirk_profiles[profile].name, name) == 0)
+        {
+            return profile;
+        }
+    }
+    return CHIP8_QUIRKS_COUNT;
+}
+
+// whole numbers only, so "10x", "" and "-1" are mistakes rather than 10,
+// 0 and a huge number
+bool chip8_parse_number(const char *text, uint64_t min, uint64_t max, uint64_t *value)
+{
+    char *end;
+    if (!isdigit((unsigned char)text[0]))
+    {
+        return false;
+    }
+
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || number < min || number > max)
+    {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+// inside chip8-quirks.inc, QUIRKED(name) is name_<profile> and QUIRK(field)
+// reads the profile's quirks out of a constant table, which folds away
+#define QUIRKED(name) QUIRKED_PASTE(name, QUIRKS)
+#define QUIRKED_PASTE(name, id) QUIRKED_PASTE_(name, id)
+#define QUIRKED_PASTE_(name, id) name##_##id
+#define QUIRK(field) (quirk_profiles[QUIRKED(CHIP8_QUIRKS)].field)
+
+// every profile gets its own interpreter, the entry points below pick
+// one per call
+_Static_assert(CHIP8_QUIRKS_COUNT == 4, "include chip8-quirks.inc once for every quirk profile");
+
+#define QUIRKS XOCHIP
+#include "chip8-quirks.inc"
+#define QUIRKS VIP
+#include "chip8-quirks.inc"
+#define QUIRKS CHIP48
+#include "chip8-quirks.inc"
+#define QUIRKS SCHIP
+#include "chip8-quirks.inc"
+
+// a switch rather than a table of pointers, so each case is a direct call
+// the cpu predicts. the jit falls back on chip8_run for every instruction
+// it doesn't translate, so this sits on its hot path
+#define STEP_CASE(id, ...)  \
+    case CHIP8_QUIRKS_##id: \
+        step_##id(chip8);   \
+        break;
+#define RUN_CASE(id, ...)   \
+    case CHIP8_QUIRKS_##id: \
+        return run_##id(chip8, max_cycles, cycles_per_tick);
+#define RUN_LEGACY_CASE(id, ...) \
+    case CHIP8_QUIRKS_##id:      \
+        return run_legacy_##id(chip8, max_cycles, cycles_per_tick);
+#define RUN_CACHED_CASE(id, ...) \
+    case CHIP8_QUIRKS_##id:      \
+        return run_cached_##id(chip8, cache, max_cycles, cycles_per_tick);
+
+void execute_opcode(struct Chip8 *chip8)
+{
+    switch (chip8->quirks)
+    {
+        CHIP8_QUIRK_PROFILES(STEP_CASE)
+    }
+}
+
+uint64_t chip8_run(struct Chip8 *chip8, uint64_t max_cycles, uint32_t cycles_per_tick)
+{
+    switch (chip8->quirks)
+    {
+        CHIP8_QUIRK_PROFILES(RUN_CASE)
+    }
+    return 0;
+}
+
+uint64_t chip8_run_legacy(struct Chip8 *chip8, uint64_t max_cycles, uint32_t cycles_per_tick)
+{
+    switch (chip8->quirks)
+    {
+        CHIP8_QUIRK_PROFILES(RUN_LEGACY_CASE)
+    }
+    return 0;
+}
+
+uint64_t chip8_run_cached(struct Chip8 *chip8, struct Chip8Cache *cache, uint64_t max_cycles, uint32_t cycles_per_tick)
+{
+    switch (chip8->quirks)
+    {
+        CHIP8_QUIRK_PROFILES(RUN_CACHED_CASE)
+    }
+    return 0;
+}
+
+#undef STEP_CASE
+#undef RUN_CASE
+#undef RUN_LEGACY_CASE
+#undef RUN_CACHED_CASE
+
+static const uint8_t state_magic[4] = {'C', '8', 'S', 'T'};
+
+static uint8_t *put16(uint8_t *at, uint16_t value)
+{
+    at[0] = value;
+    at[1] = value >> 8;
+    return at + 2;
+}
+
+static const uint8_t *get16(const uint8_t *at, uint16_t *value)
+{
+    *value = at[0] | at[1] << 8;
+    return at + 2;
+}
+
+size_t chip8_save_state(const struct Chip8 *chip8, uint8_t *buffer, size_t size)
+{
+    if (size < CHIP8_STATE_SIZE)
+    {
+        return 0;
+    }
+
+    uint8_t *at = buffer;
+    memcpy(at, state_magic, sizeof(state_magic));
+    at += sizeof(state_magic);
+    *at++ = CHIP8_STATE_VERSION;
+    *at++ = CHIP8_MEMORY_BITS;
+
+    for (uint32_t address = 0; address < CHIP8_MEMORY_SIZE; address += CHIP8_FORK_PAGE_SIZE)
+    {
+        memcpy(at, chip8_memory_page(chip8, address), CHIP8_FORK_PAGE_SIZE);
+        at += CHIP8_FORK_PAGE_SIZE;
+    }
+    memcpy(at, chip8->v_register, sizeof(chip8->v_register));
+    at += sizeof(chip8->v_register);
+
+    at = put16(at, chip8->I);
+    at = put16(at, chip8->pc);
+    for (int i = 0; i < 16; i++)
+    {
+        at = put16(at, chip8->stack[i]);
+    }
+    at = put16(at, chip8->sp);
+    *at++ = chip8->delay_timer;
+    *at++ = chip8->sound_timer;
+    memcpy(at, chip8->audio_pattern, sizeof(chip8->audio_pattern));
+    at += sizeof(chip8->audio_pattern);
+    *at++ = chip8->pitch;
+
+    *at++ = chip8->hires;
+    *at++ = chip8->planes;
+    *at++ = chip8->quirks;
+    *at++ = chip8->vblank;
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        for (int y = 0; y < SCREEN_HIRES_HEIGHT; y++)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                *at++ = chip8_gfx_row(chip8, plane, i / 8, y) >> (56 - i % 8 * 8);
+            }
+        }
+    }
+    memcpy(at, chip8->flags, sizeof(chip8->flags));
+    at += sizeof(chip8->flags);
+
+    // keys are only ever up or down
+    uint16_t keys = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        keys |= (chip8->key[i] != 0) << i;
+    }
+    at = put16(at, keys);
+
+    at = put16(at, chip8->rng_state);
+    at = put16(at, chip8->rng_state >> 16);
+
+    return at - buffer;
+}
+
+int chip8_load_state(struct Chip8 *chip8, const uint8_t *buffer, size_t size)
+{
+    if (size < CHIP8_STATE_SIZE ||
+        memcmp(buffer, state_magic, sizeof(state_magic)) != 0 ||
+        buffer[sizeof(state_magic)] != CHIP8_STATE_VERSION ||
+        buffer[sizeof(state_magic) + 1] != CHIP8_MEMORY_BITS)
+    {
+        return CHIP8_ERR_BAD_STATE;
+    }
+
+    // everything is read into a copy first so a bad snapshot changes nothing
+    struct Chip8 state = *chip8;
+    const uint8_t *at = buffer + sizeof(state_magic) + 2;
+
+    own_all_pages(&state);
+    memcpy(state.memory, at, sizeof(state.memory));
+    at += sizeof(state.memory);
+    memcpy(state.v_register, at, sizeof(state.v_register));
+    at += sizeof(state.v_register);
+
+    at = get16(at, &state.I);
+    at = get16(at, &state.pc);
+    for (int i = 0; i < 16; i++)
+    {
+        at = get16(at, &state.stack[i]);
+    }
+    at = get16(at, &state.sp);
+    state.delay_timer = *at++;
+    state.sound_timer = *at++;
+    memcpy(state.audio_pattern, at, sizeof(state.audio_pattern));
+    at += sizeof(state.audio_pattern);
+    state.pitch = *at++;
+
+    state.hires = *at++ != 0;
+    state.planes = *at++;
+    state.quirks = *at++;
+    state.vblank = *at++ != 0;
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        for (int y = 0; y < SCREEN_HIRES_HEIGHT; y++)
+        {
+            state.gfx[plane][0][y] = 0;
+            state.gfx[plane][1][y] = 0;
+            for (int i = 0; i < 16; i++)
+            {
+                state.gfx[plane][i / 8][y] = state.gfx[plane][i / 8][y] << 8 | *at++;
+            }
+        }
+    }
+    memcpy(state.flags, at, sizeof(state.flags));
+    at += sizeof(state.flags);
+
+    uint16_t keys;
+    at = get16(at, &keys);
+    for (int i = 0; i < 16; i++)
+    {
+        state.key[i] = keys >> i & 1;
+    }
+
+    uint16_t rng_low;
+    uint16_t rng_high;
+    at = get16(at, &rng_low);
+    at = get16(at, &rng_high);
+    state.rng_state = (uint32_t)rng_high << 16 | rng_low;
+
+    // any pc is fine, fetching wraps it around memory
+    if (state.sp > 16 || state.rng_state == 0 ||
+        state.planes >= 1 << CHIP8_PLANES || state.quirks >= CHIP8_QUIRKS_COUNT)
+    {
+        return CHIP8_ERR_BAD_STATE;
+    }
+
+    state.opcode = 0;
+    state.unknown_opcode = 0;
+    state.dirty_rows = ~0ULL;
+    state.written_pages = ~0ULL;
+    *chip8 = state;
+    return CHIP8_OK;
+}
+
+// everything but memory and the framebuffer, which go through the page tables
+static void copy_registers(struct Chip8 *child, const struct Chip8 *parent)
+{
+    child->opcode = parent->opcode;
+    memcpy(child->v_register, parent->v_register, sizeof(child->v_register));
+    child->I = parent->I;
+    child->pc = parent->pc;
+    child->hires = parent->hires;
+    child->planes = parent->planes;
+    child->quirks = parent->quirks;
+    child->vblank = parent->vblank;
+    child->delay_timer = parent->delay_timer;
+    child->sound_timer = parent->sound_timer;
+    memcpy(child->audio_pattern, parent->audio_pattern, sizeof(child->audio_pattern));
+    child->pitch = parent->pitch;
+    memcpy(child->stack, parent->stack, sizeof(child->stack));
+    child->sp = parent->sp;
+    memcpy(child->key, parent->key, sizeof(child->key));
+    memcpy(child->flags, parent->flags, sizeof(child->flags));
+    child->unknown_opcode = parent->unknown_opcode;
+    child->rng_state = parent->rng_state;
+}
+
+// the parent's own page, or the one it shares itself when it is a child
+// too. chip8_memory_page does the same for memory
+static const uint64_t *parent_gfx_page(const struct Chip8 *parent, uint32_t page)
+{
+    const uint64_t *shared = parent->shared_gfx[page];
+    return shared != NULL ? shared : &parent->gfx[0][0][0] + page * CHIP8_GFX_PAGE_ROWS;
+}
+
+void chip8_fork(struct Chip8 *child, const struct Chip8 *parent)
+{
+    copy_registers(child, parent);
+    child->diag = parent->diag;
+#ifdef CHIP8_PROFILE
+    child->profile = parent->profile;
+#endif
+
+    for (uint32_t page = 0; page < CHIP8_MEMORY_PAGES; page++)
+    {
+        child->shared_memory[page] = chip8_memory_page(parent, page << CHIP8_FORK_PAGE_SHIFT);
+    }
+    for (uint32_t page = 0; page < CHIP8_GFX_PAGES; page++)
+    {
+        child->shared_gfx[page] = parent_gfx_page(parent, page);
+    }
+
+    memset(child->owned_memory, 0, sizeof(child->owned_memory));
+    child->owned_gfx = 0;
+    child->dirty_rows = ~0ULL;
+    // the child may have been running something else under the same cache
+    child->written_pages = ~0ULL;
+}
+
+void chip8_rollback(struct Chip8 *child, const struct Chip8 *parent)
+{
+    copy_registers(child, parent);
+
+    // every other page still is the parent's. the ones handed back have to
+    // be looked at again by the block cache, and the screen redrawn
+    for (uint32_t word = 0; word < sizeof(child->owned_memory) / sizeof(uint64_t); word++)
+    {
+        uint64_t pages = child->owned_memory[word];
+        child->owned_memory[word] = 0;
+        // stops after the highest page taken over
+        for (uint32_t page = word * 64; pages != 0; page++, pages >>= 1)
+        {
+            if (pages & 1)
+            {
+                child->shared_memory[page] = chip8_memory_page(parent, page << CHIP8_FORK_PAGE_SHIFT);
+                mark_changed(child, page << CHIP8_FORK_PAGE_SHIFT, CHIP8_FORK_PAGE_SIZE);
+            }
+        }
+    }
+
+    uint32_t pages = child->owned_gfx;
+    if (pages != 0)
+    {
+        child->owned_gfx = 0;
+        child->dirty_rows = ~0ULL;
+        for (uint32_t page = 0; pages != 0; page++, pages >>= 1)
+        {
+            if (pages & 1)
+            {
+                child->shared_gfx[page] = parent_gfx_page(parent, page);
+            }
+        }
+    }
+}
+
+#ifdef CHIP8_PROFILE
+_Static_assert(OP_COUNT <= CHIP8_PROFILE_OPS, "CHIP8_PROFILE_OPS is too small");
+
+#define OP_NAME(name) #name,
+static const char *op_names[] = {CHIP8_OPS(OP_NAME, OP_NAME)};
+#undef OP_NAME
+
+// the hottest addresses listed in the report
+#define PROFILE_TOP_PCS 16
+
+void chip8_profile_reset(struct Chip8Profile *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+}
+
+void chip8_profile_report(const struct Chip8Profile *profile, FILE *file)
+{
+    uint64_t total = 0;
+    uint8_t order[OP_COUNT];
+
+    for (int i = 0; i < OP_COUNT; i++)
+    {
+        total += profile->op_count[i];
+        order[i] = i;
+    }
+
+    if (total == 0)
+    {
+        fprintf(file, "no instructions counted\n");
+        return;
+    }
+
+    // insertion sort, there are only a few dozen of them
+    for (int i = 1; i < OP_COUNT; i++)
+    {
+        for (int j = i; j > 0 && profile->op_count[order[j]] > profile->op_count[order[j - 1]]; j--)
+        {
+            uint8_t swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+        }
+    }
+
+    fprintf(file, "instructions: %llu\n", (unsigned long long)total);
+    for (int i = 0; i < OP_COUNT && profile->op_count[order[i]] != 0; i++)
+    {
+        uint64_t count = profile->op_count[order[i]];
+        fprintf(file, "  %-12s %12llu %6.2f%%\n", op_names[order[i]], (unsigned long long)count, 100.0 * count / total);
+    }
+
+    // picks the next hottest address below the previous one each round
+    fprintf(file, "hottest addresses:\n");
+    uint64_t below = UINT64_MAX;
+    int below_pc = -1;
+    for (int n = 0; n < PROFILE_TOP_PCS; n++)
+    {
+        int best = -1;
+        for (int pc = 0; pc < CHIP8_MEMORY_SIZE; pc++)
+        {
+            uint64_t count = profile->pc_count[pc];
+            bool after_previous = count < below || (count == below && pc > below_pc);
+            if (count != 0 && after_previous && (best < 0 || count > profile->pc_count[best]))
+            {
+                best = pc;
+            }
+        }
+
+        if (best < 0)
+        {
+            break;
+        }
+
+        below = profile->pc_count[best];
+        below_pc = best;
+        fprintf(file, "  0x%03X %12llu %6.2f%%\n", best, (unsigned long long)below, 100.0 * below / total);
+    }
+}
+#endif
+
+uint64_t chip8_gfx_hash(const struct Chip8 *chip8)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < SCREEN_HEIGHT; i++)
+    {
+        hash ^= chip8_gfx_row(chip8, 0, 0, i);
+        hash *= 0x100000001b3ULL;
+    }
+
+    // the rest of the framebuffer only counts where something is lit, so a
+    // low res single plane screen hashes the same as it always did. i runs
+    // over the words in the order they sit in gfx
+    for (size_t i = SCREEN_HEIGHT; i < sizeof(chip8->gfx) / sizeof(uint64_t); i++)
+    {
+        uint64_t word = chip8_gfx_row(chip8, i / (2 * SCREEN_HIRES_HEIGHT), i / SCREEN_HIRES_HEIGHT % 2, i % SCREEN_HIRES_HEIGHT);
+        if (word != 0)
+        {
+            hash ^= i;
+            hash *= 0x100000001b3ULL;
+            hash ^= word;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    if (chip8->hires)
+    {
+        hash ^= 1;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,581 @@
+//
+//  chip8.h
+//  first c++ project
+//
+//  Headless CHIP-8 core shared by the native and web frontends.
+//  Nothing in here depends on SDL or emscripten, so it can also be
+//  linked into tools that run without a display.
+//
+
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+// SUPER-CHIP 00FF switches to 128x64, XO-CHIP adds a second bitplane
+#define SCREEN_HIRES_WIDTH 128
+#define SCREEN_HIRES_HEIGHT 64
+#define CHIP8_PLANES 2
+
+// the address space is a power of two so every memory access, however
+// far past the end I or pc point, wraps with a single mask. 4 KB is the
+// classic machine, make MEMORY_SIZE=0x10000 builds the 64 KB XO-CHIP one
+// that F000 NNNN can address
+#ifndef CHIP8_MEMORY_SIZE
+#define CHIP8_MEMORY_SIZE 0x1000
+#endif
+#define CHIP8_MEMORY_MASK (CHIP8_MEMORY_SIZE - 1)
+#if CHIP8_MEMORY_SIZE == 0x1000
+#define CHIP8_MEMORY_BITS 12
+#elif CHIP8_MEMORY_SIZE == 0x10000
+#define CHIP8_MEMORY_BITS 16
+#else
+#error "CHIP8_MEMORY_SIZE is either 0x1000 or 0x10000"
+#endif
+// written_pages splits memory into 64 pages
+#define CHIP8_PAGE_SHIFT (CHIP8_MEMORY_BITS - 6)
+// forking shares memory and the framebuffer in 256 byte pages, the
+// framebuffer's hold 32 rows of one half of a plane
+#define CHIP8_FORK_PAGE_SHIFT 8
+#define CHIP8_FORK_PAGE_SIZE (1 << CHIP8_FORK_PAGE_SHIFT)
+#define CHIP8_MEMORY_PAGES (CHIP8_MEMORY_SIZE / CHIP8_FORK_PAGE_SIZE)
+#define CHIP8_GFX_PAGE_ROWS (CHIP8_FORK_PAGE_SIZE / 8)
+#define CHIP8_GFX_PAGES (CHIP8_PLANES * 2 * SCREEN_HIRES_HEIGHT / CHIP8_GFX_PAGE_ROWS)
+
+// where the CHIP-8 variants disagree. each named profile is compiled
+// into its own copy of the interpreter with these folded in as
+// constants, a machine picks one with its quirks field.
+//   vf_reset:     8XY1/8XY2/8XY3 clear VF
+//   shift_vy:     8XY6/8XYE shift VY into VX instead of shifting VX
+//   memory:       how far FX55/FX65 advance I, see enum Chip8MemoryQuirk
+//   jump_vx:      BNNN jumps to XNN + VX instead of NNN + V0
+//   clip:         sprites are cut off at the screen edges instead of wrapping
+//   display_wait: DXYN waits for the next 60HZ tick, at most one draw per frame
+#define CHIP8_QUIRK_PROFILES(X)                                                         \
+    /* id, name, vf_reset, shift_vy, memory, jump_vx, clip, display_wait */             \
+    X(XOCHIP, "xochip", false, true, CHIP8_MEMORY_ADDS_X_PLUS_1, false, false, false) \
+    X(VIP, "vip", true, true, CHIP8_MEMORY_ADDS_X_PLUS_1, false, true, true)          \
+    X(CHIP48, "chip48", false, false, CHIP8_MEMORY_ADDS_X, true, true, false)         \
+    X(SCHIP, "schip", false, false, CHIP8_MEMORY_KEEPS_I, true, true, false)
+
+enum Chip8MemoryQuirk
+{
+    CHIP8_MEMORY_ADDS_X_PLUS_1, // I ends up past the last register, the COSMAC VIP
+    CHIP8_MEMORY_ADDS_X,        // one short of that, CHIP-48
+    CHIP8_MEMORY_KEEPS_I,       // SUPER-CHIP 1.1
+};
+
+#define CHIP8_QUIRKS_ENUM(name, ...) CHIP8_QUIRKS_##name,
+enum Chip8QuirkProfile
+{
+    CHIP8_QUIRK_PROFILES(CHIP8_QUIRKS_ENUM)
+    CHIP8_QUIRKS_COUNT
+};
+#undef CHIP8_QUIRKS_ENUM
+
+// XO-CHIP is a superset of everything else this core implements
+#define CHIP8_QUIRKS_DEFAULT CHIP8_QUIRKS_XOCHIP
+
+struct Chip8Quirks
+{
+    const char *name;
+    bool vf_reset;
+    bool shift_vy;
+    uint8_t memory;
+    bool jump_vx;
+    bool clip;
+    bool display_wait;
+};
+
+#define PROGRAM_START 0x200
+#define FONTSET_START 0x50
+#define BIG_FONTSET_START 0xA0 // 8x10 digits for FX30
+
+// diagnostics the cpu reports instead of printing. the core writes them
+// into a lock-free single producer, single consumer ring that the frontend
+// drains once per frame. an event that repeats back to back is folded
+// into one entry and only published again when its count reaches a power
+// of two, so a rom spinning on the same instruction adds a handful of
+// entries instead of one per cycle. when the ring is full events are
+// dropped and counted
+#define CHIP8_DIAG_EVENTS 64
+
+enum Chip8DiagLevel
+{
+    CHIP8_DIAG_INFO,
+    CHIP8_DIAG_WARNING,
+};
+
+enum Chip8DiagCode
+{
+    CHIP8_DIAG_UNKNOWN_OPCODE,
+    CHIP8_DIAG_WAIT_KEY,        // FX0A is waiting for a key
+    CHIP8_DIAG_STACK_OVERFLOW,  // 2NNN with all 16 levels in use, the stack wraps
+    CHIP8_DIAG_STACK_UNDERFLOW, // 00EE with nothing to return to, the stack wraps
+    CHIP8_DIAG_MEMORY_WRAP,     // an access through I ran past the end of memory and wrapped
+};
+
+struct Chip8DiagEvent
+{
+    uint8_t level;
+    uint8_t code;
+    uint16_t pc;
+    uint16_t opcode;
+    uint32_t count; // how many times in a row it happened up to this entry
+};
+
+struct Chip8Diag
+{
+    atomic_uint head;    // only the core writes it
+    atomic_uint tail;    // only the reader writes it
+    atomic_uint dropped; // events lost to a full ring since the last chip8_diag_dropped
+    struct Chip8DiagEvent events[CHIP8_DIAG_EVENTS];
+    struct Chip8DiagEvent last; // the core's copy of the event being folded
+};
+
+#ifdef CHIP8_PROFILE
+// built with make PROFILE=1: counts every instruction the interpreter and
+// the block cache execute, by decoded instruction and by address. code the
+// jit translated runs uncounted
+#define CHIP8_PROFILE_OPS 64
+
+struct Chip8Profile
+{
+    uint64_t op_count[CHIP8_PROFILE_OPS];
+    uint64_t pc_count[CHIP8_MEMORY_SIZE];
+};
+#endif
+
+struct Chip8
+{
+    uint8_t opcode;
+    uint8_t memory[CHIP8_MEMORY_SIZE];
+    uint8_t v_register[16];
+    uint16_t I; // special register to store memory addresses, F000 NNNN loads all 16 bits
+    uint16_t pc;
+    // [plane][half][row], one word per row for each 64 pixel half of the
+    // screen, bit 63 is the leftmost pixel. low res only uses the first 32
+    // rows of the left half, so they sit exactly where a 64x32 screen would
+    uint64_t gfx[CHIP8_PLANES][2][SCREEN_HIRES_HEIGHT];
+    uint64_t dirty_rows; // bit n set when row n changed, cleared by the frontend once drawn
+    bool hires;          // 00FF, the screen is SCREEN_HIRES_WIDTH x SCREEN_HIRES_HEIGHT
+    uint8_t planes;      // FN01, the bitplanes 00E0, DXYN and scrolling work on
+    uint8_t quirks;      // enum Chip8QuirkProfile, initialize_chip8 sets CHIP8_QUIRKS_DEFAULT
+    bool vblank;         // a 60HZ tick came since the last DXYN, for display_wait
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t audio_pattern[16]; // XO-CHIP: the 128 one bit samples the beep loops over, F002 loads it
+    uint8_t pitch;             // XO-CHIP: FX3A, the pattern plays at 4000 * 2^((pitch - 64) / 48) bits per second
+    uint16_t stack[16];
+    uint16_t sp;
+    uint8_t key[16];
+    uint8_t flags[16];       // SUPER-CHIP FX75/FX85 storage
+    uint16_t unknown_opcode; // last opcode the cpu could not decode, 0 if none
+    uint32_t rng_state;      // per instance CXNN generator so runs are reproducible and thread safe
+    uint64_t written_pages;  // 1 << CHIP8_PAGE_SHIFT byte pages of memory stored to since the block cache last looked
+    // a forked child's pages it hasn't written yet, read from its parent.
+    // NULL for a page held in memory or gfx above, which is all of them
+    // for a machine that never forked
+    const uint8_t *shared_memory[CHIP8_MEMORY_PAGES];
+    const uint64_t *shared_gfx[CHIP8_GFX_PAGES];
+    // bit n set for each page above taken over since the last fork or
+    // rollback, the ones rolling back has to hand back to the parent
+    uint64_t owned_memory[(CHIP8_MEMORY_PAGES + 63) / 64];
+    uint32_t owned_gfx;
+    struct Chip8Diag *diag;  // NULL drops diagnostics, initialize_chip8 detaches it
+#ifdef CHIP8_PROFILE
+    struct Chip8Profile *profile; // NULL when not counting, initialize_chip8 detaches it
+#endif
+};
+
+static inline int chip8_screen_width(const struct Chip8 *chip8)
+{
+    return chip8->hires ? SCREEN_HIRES_WIDTH : SCREEN_WIDTH;
+}
+
+static inline int chip8_screen_height(const struct Chip8 *chip8)
+{
+    return chip8->hires ? SCREEN_HIRES_HEIGHT : SCREEN_HEIGHT;
+}
+
+// memory and the framebuffer are read through these, so a forked child
+// sees its parent's pages until it writes its own
+static inline const uint8_t *chip8_memory_page(const struct Chip8 *chip8, uint32_t address)
+{
+    uint32_t page = (address & CHIP8_MEMORY_MASK) >> CHIP8_FORK_PAGE_SHIFT;
+    const uint8_t *shared = chip8->shared_memory[page];
+    if (shared == NULL)
+    {
+        return &chip8->memory[page << CHIP8_FORK_PAGE_SHIFT];
+    }
+    return shared;
+}
+
+static inline uint8_t chip8_peek(const struct Chip8 *chip8, uint32_t address)
+{
+    return chip8_memory_page(chip8, address)[address & (CHIP8_FORK_PAGE_SIZE - 1)];
+}
+
+static inline uint64_t chip8_gfx_row(const struct Chip8 *chip8, int plane, int half, int y)
+{
+    const uint64_t *shared = chip8->shared_gfx[((plane * 2 + half) * SCREEN_HIRES_HEIGHT + y) / CHIP8_GFX_PAGE_ROWS];
+    return shared != NULL ? shared[y % CHIP8_GFX_PAGE_ROWS] : chip8->gfx[plane][half][y];
+}
+
+// the pixel's color, bit n set when it is lit on plane n
+static inline int chip8_pixel(const struct Chip8 *chip8, int x, int y)
+{
+    int color = 0;
+    for (int plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        color |= (chip8_gfx_row(chip8, plane, x >> 6, y) >> (63 - (x & 63)) & 1) << plane;
+    }
+    return color;
+}
+
+// a 1NNN jump to itself, or the SUPER-CHIP 00FD exit which leaves the pc
+// where it is, is how ROMs park the cpu once they are done. NNN only
+// reaches the first 4 KB, so in the 64 KB build a jump at 0x1ABC to 0xABC
+// goes somewhere else, and code above 0xFFF can only park with 00FD
+static inline bool chip8_parks(uint16_t opcode, uint16_t pc)
+{
+    return ((opcode & 0xF000) == 0x1000 && (opcode & 0x0FFF) == pc) || opcode == 0x00FD;
+}
+
+enum Chip8Error
+{
+    CHIP8_OK = 0,
+    CHIP8_ERR_OPEN,
+    CHIP8_ERR_TOO_LARGE,
+    CHIP8_ERR_NO_MEMORY,
+    CHIP8_ERR_READ,
+    CHIP8_ERR_BAD_STATE,
+    CHIP8_ERR_WRITE,
+    CHIP8_ERR_BAD_MOVIE,
+    CHIP8_ERR_BAD_CORPUS,
+    CHIP8_ERR_NO_JIT,
+};
+
+void initialize_chip8(struct Chip8 *chip8);
+void chip8_seed(struct Chip8 *chip8, uint32_t seed);
+
+// NULL for a profile that doesn't exist
+const struct Chip8Quirks *chip8_quirks(int profile);
+// looks a profile up by its lower case name, CHIP8_QUIRKS_COUNT when none matches
+int chip8_quirks_from_name(const char *name);
+// reads a whole decimal number from min to max for the command lines,
+// false on anything else
+bool chip8_parse_number(const char *text, uint64_t min, uint64_t max, uint64_t *value);
+
+#define CHIP8_PROGRAM_MAX (CHIP8_MEMORY_SIZE - PROGRAM_START)
+
+// reads a whole rom file into program and sets size
+int chip8_read_program(const char *filename, uint8_t program[CHIP8_PROGRAM_MAX], size_t *size);
+// both loaders leave the machine untouched when they fail
+int load_program_to_memory(const char *filename, struct Chip8 *chip8);
+int load_program_from_buffer(const uint8_t *program, size_t size, struct Chip8 *chip8);
+const char *chip8_strerror(int error);
+
+void execute_opcode(struct Chip8 *chip8);
+
+// call at 60HZ, returns true while the sound timer wants the beep playing
+bool chip8_tick_timers(struct Chip8 *chip8);
+
+void handle_keypres(struct Chip8 *chip8, int index, bool pressed);
+
+// true when the next instruction parks the cpu, see chip8_parks
+bool chip8_is_halted(const struct Chip8 *chip8);
+
+// true when the next instruction is an FX0A with no key down to take. it
+// would only run again and again without changing anything, so a frontend
+// can stop executing and sleep until input arrives; the timers still tick
+bool chip8_waiting_for_key(const struct Chip8 *chip8);
+
+// headless run loop without any frame pacing. executes up to max_cycles
+// instructions, ticking the timers every cycles_per_tick instructions
+// (0 disables them), and stops early when the cpu halts. returns the number
+// of instructions executed
+uint64_t chip8_run(struct Chip8 *chip8, uint64_t max_cycles, uint32_t cycles_per_tick);
+
+// chip8_run with the pre-table dispatch, every instruction decoded through
+// nested switches. same results, only kept to benchmark against
+uint64_t chip8_run_legacy(struct Chip8 *chip8, uint64_t max_cycles, uint32_t cycles_per_tick);
+
+#define CHIP8_BLOCK_MAX 16
+#define CHIP8_CACHE_BLOCKS 1024
+
+// straight line run of predecoded instructions, ending at a jump, call,
+// draw, store or key wait. a taken skip leaves it early
+struct Chip8Block
+{
+    uint16_t pc;
+    uint8_t count; // 0 when pc parks on a 1NNN self-jump or 00FD
+    uint64_t pages; // memory pages the block was decoded from
+    uint8_t op[CHIP8_BLOCK_MAX];
+    uint16_t opcode[CHIP8_BLOCK_MAX];
+};
+
+// decoded blocks keyed by pc. a cache belongs to one machine at a time.
+// stores through FX33/FX55, initialize_chip8 and the loaders all mark the
+// pages they write, so copying a freshly loaded machine over the old one
+// flushes it by itself. call chip8_cache_reset after anything else swaps
+// the memory under it
+struct Chip8Cache
+{
+    uint16_t block_at[CHIP8_MEMORY_SIZE]; // index + 1 into blocks, 0 when not decoded
+    uint16_t count;
+    struct Chip8Block blocks[CHIP8_CACHE_BLOCKS];
+};
+
+void chip8_cache_reset(struct Chip8Cache *cache);
+
+// same as chip8_run, with the same results, but executes whole cached
+// blocks instead of fetching and decoding every instruction
+uint64_t chip8_run_cached(struct Chip8 *chip8, struct Chip8Cache *cache, uint64_t max_cycles, uint32_t cycles_per_tick);
+
+// x86-64 recompiler for the same workloads. translated blocks keep the
+// exact cycle and timer behaviour of chip8_run, everything the translator
+// doesn't handle runs through the interpreter. create returns NULL on
+// targets without a native backend. like the block cache, a jit belongs
+// to one machine at a time
+struct Chip8Jit;
+
+struct Chip8Jit *chip8_jit_create(void);
+void chip8_jit_destroy(struct Chip8Jit *jit);
+void chip8_jit_reset(struct Chip8Jit *jit);
+uint64_t chip8_run_jit(struct Chip8 *chip8, struct Chip8Jit *jit, uint64_t max_cycles, uint32_t cycles_per_tick);
+
+// parallel headless runs (chip8-pool.c, native builds only, link with
+// -pthread). every job is a copy of its rom seeded with its own seed, and
+// the jobs are spread over worker threads that steal from each other when
+// they run dry. each worker keeps its own block cache or jit
+#define CHIP8_POOL_MAX_THREADS 256
+
+enum Chip8Backend
+{
+    CHIP8_BACKEND_CACHED = 0, // chip8_run_cached
+    CHIP8_BACKEND_INTERP,     // chip8_run
+    CHIP8_BACKEND_JIT,        // chip8_run_jit
+};
+
+struct Chip8Job
+{
+    const struct Chip8 *rom;
+    uint32_t seed;
+    const char *movie; // when not NULL, replayed through chip8_replay instead of running rom
+
+    // filled in by the pool
+    int error; // a movie that couldn't be played, CHIP8_OK otherwise
+    uint64_t cycles;
+    uint32_t restarts; // times the rom halted and started over, with restart
+    bool halted;
+    uint16_t pc;
+    uint16_t I;
+    uint16_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t v_register[16];
+    uint64_t gfx_hash;
+};
+
+struct Chip8PoolThread
+{
+    uint32_t jobs;
+    uint32_t steals;
+    uint64_t cycles;
+};
+
+struct Chip8Pool
+{
+    int threads; // 0 for one per core, never more than there are jobs
+    int backend; // enum Chip8Backend
+    uint64_t max_cycles;
+    uint32_t cycles_per_tick;
+    bool restart; // a rom that halts starts over until its budget is spent, for benchmarks
+
+    // filled in by chip8_pool_run
+    int thread_count;
+    struct Chip8PoolThread thread_stats[CHIP8_POOL_MAX_THREADS];
+};
+
+// runs every job to completion. CHIP8_ERR_NO_JIT when the jit backend was
+// asked for on a target without one
+int chip8_pool_run(struct Chip8Pool *pool, struct Chip8Job *jobs, uint32_t count);
+
+// versioned little endian snapshot of everything a program can observe:
+// memory, registers, stack, timers, framebuffer, keys, the quirk profile
+// and the CXNN generator. the block cache and jit notice a restored
+// machine by themselves. a snapshot only loads into a build with the
+// same memory size
+#define CHIP8_STATE_VERSION 5
+#define CHIP8_STATE_SIZE (4 + 1 + 1 + CHIP8_MEMORY_SIZE + 16 + 2 + 2 + 16 * 2 + 2 + 1 + 1 + 16 + 1 + \
+                          1 + 1 + 1 + 1 + CHIP8_PLANES * SCREEN_HIRES_HEIGHT * 16 + 16 + 2 + 4)
+
+// returns the number of bytes written, 0 when buffer is too small
+size_t chip8_save_state(const struct Chip8 *chip8, uint8_t *buffer, size_t size);
+// leaves the machine untouched when the snapshot is rejected
+int chip8_load_state(struct Chip8 *chip8, const uint8_t *buffer, size_t size);
+
+// movie files: a save state of the starting machine followed by every key
+// change, 60HZ timer tick and restored state with the cycle it happened
+// on. a frontend counts the instructions it executes and reports each
+// event after running up to it; replaying the file through the
+// interpreter ends in the same registers and framebuffer
+#define CHIP8_MOVIE_VERSION 1
+
+enum Chip8MovieEvent
+{
+    CHIP8_MOVIE_KEY_UP = 0,    // plus the key index
+    CHIP8_MOVIE_KEY_DOWN = 16, // plus the key index
+    CHIP8_MOVIE_TICK = 32,
+    CHIP8_MOVIE_STATE = 33, // followed by a save state
+    CHIP8_MOVIE_END = 34,
+};
+
+struct Chip8Recorder
+{
+    FILE *file;
+    uint64_t cycle; // cycle of the last event written
+};
+
+int chip8_record_start(struct Chip8Recorder *recorder, const char *filename, const struct Chip8 *chip8);
+void chip8_record_key(struct Chip8Recorder *recorder, uint64_t cycle, int index, bool pressed);
+void chip8_record_tick(struct Chip8Recorder *recorder, uint64_t cycle);
+// after anything that replaces the machine, a loaded save state or a rewind
+void chip8_record_state(struct Chip8Recorder *recorder, uint64_t cycle, const struct Chip8 *chip8);
+int chip8_record_stop(struct Chip8Recorder *recorder, uint64_t cycle);
+// cycles is set to the number of instructions the movie covers
+int chip8_replay(const char *filename, struct Chip8 *chip8, uint64_t *cycles);
+
+// rom archives, made with chip8-pack. thousands of roms packed into one
+// file that is mapped rather than read, behind an index of their SHA-1 and
+// CRC-32 with the name, size and quirk profile of each. loading a rom out
+// of an open corpus is a single copy into memory, and any rom file can be
+// looked up by its contents to find the profile it wants
+#define CHIP8_CORPUS_VERSION 1
+#define CHIP8_SHA1_SIZE 20
+
+struct Chip8CorpusEntry
+{
+    uint8_t sha1[CHIP8_SHA1_SIZE];
+    uint32_t crc32;
+    uint8_t quirks; // enum Chip8QuirkProfile
+    const char *name;
+    const uint8_t *data; // inside the mapped archive once it is open
+    uint32_t size;
+};
+
+struct Chip8Corpus
+{
+    const uint8_t *map;
+    size_t map_size;
+    uint32_t count;
+    struct Chip8CorpusEntry *entries; // sorted by sha1
+};
+
+void chip8_sha1(const uint8_t *data, size_t size, uint8_t digest[CHIP8_SHA1_SIZE]);
+uint32_t chip8_crc32(const uint8_t *data, size_t size);
+
+int chip8_corpus_open(struct Chip8Corpus *corpus, const char *filename);
+void chip8_corpus_close(struct Chip8Corpus *corpus);
+// NULL when the corpus doesn't have it
+const struct Chip8CorpusEntry *chip8_corpus_find(const struct Chip8Corpus *corpus, const uint8_t sha1[CHIP8_SHA1_SIZE]);
+const struct Chip8CorpusEntry *chip8_corpus_find_crc(const struct Chip8Corpus *corpus, uint32_t crc32);
+const struct Chip8CorpusEntry *chip8_corpus_lookup(const struct Chip8Corpus *corpus, const uint8_t *program, size_t size);
+// loads the rom and switches the machine to its quirk profile
+int chip8_corpus_load(const struct Chip8CorpusEntry *entry, struct Chip8 *chip8);
+// loads a rom file, taking its quirk profile from the corpus when the
+// corpus knows it. corpus may be NULL
+int chip8_corpus_load_file(const struct Chip8Corpus *corpus, const char *filename, struct Chip8 *chip8);
+// entries come with name, data, size and quirks filled in. hashes them,
+// sorts them and drops repeated contents, count is updated to match
+int chip8_corpus_write(const char *filename, struct Chip8CorpusEntry *entries, uint32_t *count);
+
+// rewind history in a fixed size ring. push one frame per 60HZ tick, step
+// drops the newest frame and loads the one before it, false once only
+// one frame is left. every keyframe_interval frames a whole save state is
+// kept, the frames in between store XOR deltas. capacity is the size of
+// the ring in bytes, the oldest history is dropped when it is full
+struct Chip8Rewind;
+
+struct Chip8Rewind *chip8_rewind_create(size_t capacity, uint32_t keyframe_interval);
+void chip8_rewind_destroy(struct Chip8Rewind *rewind);
+void chip8_rewind_clear(struct Chip8Rewind *rewind);
+uint32_t chip8_rewind_frames(const struct Chip8Rewind *rewind);
+void chip8_rewind_push(struct Chip8Rewind *rewind, const struct Chip8 *chip8);
+bool chip8_rewind_step(struct Chip8Rewind *rewind, struct Chip8 *chip8);
+
+// cheap forking for tree search. a child copies its parent's registers
+// and points its page tables at the parent's pages, and takes a copy of a
+// page only the first time it writes to it. rolling back points the
+// tables at the parent again, so neither copies memory or the screen.
+// the parent must stay unchanged, and alive, while children fork from it.
+// a plain struct copy of a child shares the same pages
+
+void chip8_fork(struct Chip8 *child, const struct Chip8 *parent);
+void chip8_rollback(struct Chip8 *child, const struct Chip8 *parent);
+
+// the beep, generated inside the frontend's audio callback. the thread
+// running the cpu calls update after executing, which publishes the sound
+// timer whenever the program wrote it and the XO-CHIP pattern and pitch
+// whenever they changed. render picks that up once per buffer and plays
+// exactly that many 60HZ ticks worth of the pattern from the first sample
+// of the buffer on, resampled to the device rate. unsigned 8 bit mono
+#define CHIP8_TIMER_HZ 60
+#define CHIP8_AUDIO_SILENCE 128
+#define CHIP8_AUDIO_VOLUME 64
+
+struct Chip8Audio
+{
+    // written by the cpu thread. pattern is double buffered, the slot in
+    // use is the low bit of the publication count kept in request
+    atomic_uint request;
+    atomic_uint pattern[2][4];
+    uint32_t count;
+    uint8_t sound_timer; // what the callback was last told, counted down with the ticks
+    uint8_t pitch;
+    uint8_t last_pattern[16];
+
+    // everything below belongs to the audio callback
+    uint32_t seen;
+    uint32_t rate;
+    uint32_t remaining; // samples left in the current beep
+    uint32_t position;  // in the pattern, 16.16 fixed point bits
+    uint32_t step;      // pattern bits per output sample, 16.16
+    uint32_t gain;      // turns the area under the pattern covered by one step into a level
+    uint16_t total;     // one bits in the pattern
+    uint8_t bits[256];  // the pattern one bit per byte, twice so a step can run past its end
+    uint16_t ones[256]; // one bits in front of each entry of bits
+};
+
+void chip8_audio_init(struct Chip8Audio *audio, uint32_t rate);
+void chip8_audio_update(struct Chip8Audio *audio, const struct Chip8 *chip8);
+// after chip8_tick_timers, the callback counts the beep down by itself
+void chip8_audio_tick(struct Chip8Audio *audio, const struct Chip8 *chip8);
+// stops the beep without touching the machine, for rewinding
+void chip8_audio_silence(struct Chip8Audio *audio);
+void chip8_audio_render(struct Chip8Audio *audio, uint8_t *stream, size_t samples);
+
+void chip8_diag_init(struct Chip8Diag *diag);
+// false once the ring is empty
+bool chip8_diag_read(struct Chip8Diag *diag, struct Chip8DiagEvent *event);
+// returns and clears the number of events dropped
+uint32_t chip8_diag_dropped(struct Chip8Diag *diag);
+const char *chip8_diag_message(int code);
+
+#ifdef CHIP8_PROFILE
+void chip8_profile_reset(struct Chip8Profile *profile);
+// instruction counts from most to least frequent, then the hottest addresses
+void chip8_profile_report(const struct Chip8Profile *profile, FILE *file);
+#endif
+
+// FNV-1a hash of the framebuffer, used to compare runs
+uint64_t chip8_gfx_hash(const struct Chip8 *chip8);
+
+#endif
@@ -0,0 +1,985 @@
+//
+//  frontend.c
+//  first c++ project
+//
+//  Everything the native and web frontends have in common. Both compile
+//  this file next to their own entry point, main.c and main-web.c.
+//
+
+#include "frontend.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ROM "roms/test_opcode.ch8"
+#define DEFAULT_SCALE 10
+#define MAX_SCALE 40
+// ARGB8888 colors for lit and unlit pixels, and for the XO-CHIP second
+// plane alone and both planes lit
+#define PIXEL_ON 0xFFFF0000
+#define PIXEL_OFF 0xFF000000
+#define PIXEL_PLANE2 0xFFFFAA00
+#define PIXEL_BOTH 0xFFFFFFFF
+#define DEFAULT_IPS 700
+// the beep is generated in the audio callback, a 512 sample buffer keeps
+// it within about 10ms of the timer. browsers refill the buffer from the
+// page's own event loop, so there it stays at about 20ms to not crackle
+#define AUDIO_RATE 48000
+#ifdef __EMSCRIPTEN__
+#define AUDIO_SAMPLES 1024
+#else
+#define AUDIO_SAMPLES 512
+#endif
+// cap how far the scheduler catches up after a stall (debugger, window
+// drag, a tab in the background)
+#define MAX_CATCHUP_SECONDS 0.25
+// a few minutes of rewind history, a whole keyframe every 2 seconds
+#define REWIND_BYTES (384 * 1024)
+#define REWIND_KEYFRAME_INTERVAL 120
+// headless instances run flat out for this many instructions each
+#define DEFAULT_HEADLESS_CYCLES 10000000
+#define MAX_INSTANCES 65536
+
+static const char *renderer_names[RENDERER_BACKENDS] = {"auto", "gpu", "software"};
+
+// every setting, --name on the command line and name = value in a config
+// file. a flag can leave its value out on the command line
+struct Setting
+{
+    const char *name;
+    bool flag;
+};
+
+static const struct Setting settings[] = {
+    {"config", false},
+    {"rom", false},
+    {"ips", false},
+    {"scale", false},
+    {"renderer", false},
+    {"quirks", false},
+    {"corpus", false},
+    {"record", false},
+    {"headless", true},
+    {"bench", true},
+    {"instances", false},
+    {"threads", false},
+    {"interp", true},
+    {"jit", true},
+    {"cycles", false},
+};
+
+#ifdef CHIP8_PROFILE
+static const char *profile_section_names[PROFILE_SECTIONS] = {"execute_opcode", "draw_display", "handle_timer", "events"};
+#endif
+
+// indexed by chip8_pixel
+static const uint32_t palette[1 << CHIP8_PLANES] = {PIXEL_OFF, PIXEL_ON, PIXEL_PLANE2, PIXEL_BOTH};
+
+void usage(const char *program)
+{
+    printf("usage: %s [options] [rom]\n", program);
+    printf("  rom            the rom to run (default %s)\n", DEFAULT_ROM);
+    printf("  --config F     read settings from F first, one \"name = value\" per line named like\n");
+    printf("                 these options, the command line overrides them\n");
+    printf("  --ips N        instructions per second (default %d)\n", DEFAULT_IPS);
+    printf("  --scale N      window pixels per chip-8 pixel, 1 to %d (default %d)\n", MAX_SCALE, DEFAULT_SCALE);
+    printf("  --renderer R   auto (default), gpu or software\n");
+    printf("  --quirks P     behave like xochip (default), vip, chip48 or schip\n");
+    printf("  --corpus F     take the rom's quirk profile from the chip8-pack archive F\n");
+    printf("  --record F     record a movie of the session to F\n");
+    printf("  --headless     no window or audio, run flat out and print the final state\n");
+    printf("  --instances N  headless, run N copies of the rom seeded 0 to N-1 (default 1)\n");
+    printf("  --threads N    headless, spread the instances over N threads (default: one per core)\n");
+    printf("  --cycles K     headless, instructions per instance (default %d)\n", DEFAULT_HEADLESS_CYCLES);
+    printf("  --interp       headless, decode every instruction instead of running cached blocks\n");
+    printf("  --jit          headless, translate hot blocks to native code (x86-64 only)\n");
+    printf("  --bench        headless, restart roms that halt and only print the throughput\n");
+    printf("flags take an optional true or false, --headless false turns one back off\n");
+}
+
+void config_init(struct Config *config)
+{
+    snprintf(config->rom, sizeof(config->rom), "%s", DEFAULT_ROM);
+    config->ips = DEFAULT_IPS;
+    config->scale = DEFAULT_SCALE;
+    config->renderer = RENDERER_AUTO;
+    config->quirks = CHIP8_QUIRKS_COUNT;
+    config->corpus[0] = '\0';
+    config->record[0] = '\0';
+    config->headless = false;
+    config->bench = false;
+    config->instances = 1;
+    config->threads = 0;
+    config->backend = CHIP8_BACKEND_CACHED;
+    config->cycles = DEFAULT_HEADLESS_CYCLES;
+}
+
+static const struct Setting *find_setting(const char *name)
+{
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+    {
+        if (strcmp(name, settings[i].name) == 0)
+        {
+            return &settings[i];
+        }
+    }
+    return NULL;
+}
+
+static bool parse_flag(const char *text, bool *value)
+{
+    if (strcmp(text, "true") == 0 || strcmp(text, "yes") == 0 || strcmp(text, "1") == 0)
+    {
+        *value = true;
+    }
+    else if (strcmp(text, "false") == 0 || strcmp(text, "no") == 0 || strcmp(text, "0") == 0)
+    {
+        *value = false;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// --interp and --jit pick the headless backend, turning one off goes back
+// to the block cache
+static bool parse_backend(const char *text, int backend, int *value)
+{
+    bool on;
+    if (!parse_flag(text, &on))
+    {
+        return false;
+    }
+
+    if (on)
+    {
+        *value = backend;
+    }
+    else if (*value == backend)
+    {
+        *value = CHIP8_BACKEND_CACHED;
+    }
+    return true;
+}
+
+static bool copy_string(char *to, size_t size, const char *value)
+{
+    return snprintf(to, size, "%s", value) < (int)size;
+}
+
+// applies one setting from the command line or the config file, and returns
+// what was wrong with it or NULL. strings are copied, a config file line
+// doesn't outlive the parse
+const char *set_option(struct Config *config, const char *name, const char *value)
+{
+    uint64_t number;
+    bool valid = true;
+
+    if (strcmp(name, "rom") == 0)
+    {
+        valid = copy_string(config->rom, sizeof(config->rom), value);
+    }
+    else if (strcmp(name, "ips") == 0)
+    {
+        valid = chip8_parse_number(value, 1, UINT32_MAX, &number);
+        config->ips = (uint32_t)number;
+    }
+    else if (strcmp(name, "scale") == 0)
+    {
+        valid = chip8_parse_number(value, 1, MAX_SCALE, &number);
+        config->scale = (int)number;
+    }
+    else if (strcmp(name, "renderer") == 0)
+    {
+        config->renderer = 0;
+        while (config->renderer < RENDERER_BACKENDS && strcmp(value, renderer_names[config->renderer]) != 0)
+        {
+            config->renderer++;
+        }
+        valid = config->renderer < RENDERER_BACKENDS;
+    }
+    else if (strcmp(name, "quirks") == 0)
+    {
+        config->quirks = chip8_quirks_from_name(value);
+        valid = config->quirks != CHIP8_QUIRKS_COUNT;
+    }
+    else if (strcmp(name, "corpus") == 0)
+    {
+        valid = copy_string(config->corpus, sizeof(config->corpus), value);
+    }
+    else if (strcmp(name, "record") == 0)
+    {
+        valid = copy_string(config->record, sizeof(config->record), value);
+    }
+    else if (strcmp(name, "headless") == 0)
+    {
+        valid = parse_flag(value, &config->headless);
+    }
+    else if (strcmp(name, "bench") == 0)
+    {
+        valid = parse_flag(value, &config->bench);
+    }
+    else if (strcmp(name, "instances") == 0)
+    {
+        valid = chip8_parse_number(value, 1, MAX_INSTANCES, &number);
+        config->instances = (uint32_t)number;
+    }
+    else if (strcmp(name, "threads") == 0)
+    {
+        valid = chip8_parse_number(value, 1, CHIP8_POOL_MAX_THREADS, &number);
+        config->threads = (int)number;
+    }
+    else if (strcmp(name, "interp") == 0)
+    {
+        valid = parse_backend(value, CHIP8_BACKEND_INTERP, &config->backend);
+    }
+    else if (strcmp(name, "jit") == 0)
+    {
+        valid = parse_backend(value, CHIP8_BACKEND_JIT, &config->backend);
+    }
+    else if (strcmp(name, "cycles") == 0)
+    {
+        valid = chip8_parse_number(value, 1, UINT64_MAX, &number);
+        config->cycles = number;
+    }
+    else
+    {
+        return "unknown setting";
+    }
+
+    return valid ? NULL : "bad value for";
+}
+
+static char *trim(char *text)
+{
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+    *end = '\0';
+    return text;
+}
+
+// "name = value" lines, blank lines and everything after a # are ignored
+static bool load_config(struct Config *config, const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        printf("Error: %s %s\n", chip8_strerror(CHIP8_ERR_OPEN), filename);
+        return false;
+    }
+
+    char line[CONFIG_LINE_MAX];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        number++;
+        line[strcspn(line, "#")] = '\0';
+        char *name = trim(line);
+        if (*name == '\0')
+        {
+            continue;
+        }
+
+        char *equals = strchr(name, '=');
+        if (equals == NULL)
+        {
+            printf("Error: %s:%d: expected name = value\n", filename, number);
+            ok = false;
+            break;
+        }
+
+        // a config file can't pull in another one, set_option doesn't know config
+        *equals = '\0';
+        name = trim(name);
+        char *value = trim(equals + 1);
+        const char *problem = set_option(config, name, value);
+        if (problem != NULL)
+        {
+            printf("Error: %s:%d: %s %s\n", filename, number, problem, name);
+            ok = false;
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// reads the option or rom at argv[*i] and moves past it along with its
+// value, so both passes over the command line split it up the same way. a
+// flag only takes the next argument as its value when it's true, false,
+// yes, no, 1 or 0. prints what was wrong and returns false otherwise
+static bool next_argument(int argc, char *argv[], int *i, const char **name, const char **value)
+{
+    const char *arg = argv[(*i)++];
+    if (strncmp(arg, "--", 2) != 0)
+    {
+        *name = "rom";
+        *value = arg;
+        return true;
+    }
+
+    *name = arg + 2;
+    const struct Setting *setting = find_setting(*name);
+    if (setting == NULL)
+    {
+        printf("Error: unknown setting %s\n", arg);
+        return false;
+    }
+
+    bool ignored;
+    if (setting->flag)
+    {
+        *value = "true";
+        if (*i < argc && parse_flag(argv[*i], &ignored))
+        {
+            *value = argv[(*i)++];
+        }
+    }
+    else if (*i < argc)
+    {
+        *value = argv[(*i)++];
+    }
+    else
+    {
+        printf("Error: %s needs a value\n", arg);
+        return false;
+    }
+    return true;
+}
+
+// the config file goes first wherever --config appears, so the rest of the
+// command line always overrides it
+bool parse_arguments(int argc, char *argv[], struct Config *config)
+{
+    const char *name;
+    const char *value;
+
+    for (int i = 1; i < argc;)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            usage(argv[0]);
+            exit(0);
+        }
+        if (!next_argument(argc, argv, &i, &name, &value))
+        {
+            usage(argv[0]);
+            return false;
+        }
+        if (strcmp(name, "config") == 0 && !load_config(config, value))
+        {
+            return false;
+        }
+    }
+
+    // the first pass already checked every name and value count
+    for (int i = 1; i < argc;)
+    {
+        next_argument(argc, argv, &i, &name, &value);
+        const char *problem = strcmp(name, "config") == 0 ? NULL : set_option(config, name, value);
+        if (problem != NULL)
+        {
+            printf("Error: %s --%s %s\n", problem, name, value);
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    // benchmarking never opens a window
+    if (config->bench)
+    {
+        config->headless = true;
+    }
+    if (!config->headless && config->instances > 1)
+    {
+        printf("Error: only headless runs take more than one instance\n");
+        return false;
+    }
+    if (config->headless && config->record[0] != '\0')
+    {
+        printf("Error: only runs with a window can be recorded\n");
+        return false;
+    }
+    return true;
+}
+
+// a profile from the settings wins over the corpus and the default
+bool load_rom(const struct Config *config, struct Chip8 *chip8)
+{
+    // only the index is needed, to find the rom's quirk profile by its contents
+    struct Chip8Corpus corpus = {0};
+    if (config->corpus[0] != '\0')
+    {
+        int error = chip8_corpus_open(&corpus, config->corpus);
+        if (error != CHIP8_OK)
+        {
+            printf("Error: %s %s\n", chip8_strerror(error), config->corpus);
+            return false;
+        }
+    }
+
+    int error = chip8_corpus_load_file(config->corpus[0] != '\0' ? &corpus : NULL, config->rom, chip8);
+    chip8_corpus_close(&corpus);
+    if (error != CHIP8_OK)
+    {
+        printf("Error: %s %s\n", chip8_strerror(error), config->rom);
+        return false;
+    }
+    if (config->quirks != CHIP8_QUIRKS_COUNT)
+    {
+        chip8->quirks = config->quirks;
+    }
+    return true;
+}
+
+static int get_app_key_number(SDL_Keycode keycode)
+{
+    switch (keycode)
+    {
+    case SDLK_1:
+        return 0;
+    case SDLK_2:
+        return 1;
+    case SDLK_3:
+        return 2;
+    case SDLK_4:
+        return 3;
+    case SDLK_q:
+        return 4;
+    case SDLK_w:
+        return 5;
+    case SDLK_e:
+        return 6;
+    case SDLK_r:
+        return 7;
+    case SDLK_a:
+        return 8;
+    case SDLK_s:
+        return 9;
+    case SDLK_d:
+        return 10;
+    case SDLK_f:
+        return 11;
+    case SDLK_z:
+        return 12;
+    case SDLK_x:
+        return 13;
+    case SDLK_c:
+        return 14;
+    case SDLK_v:
+        return 15;
+    default:
+        return -1; // Not found
+    }
+}
+
+static void sdl_error(const char msg[])
+{
+    printf("%s: %s\n", msg, SDL_GetError());
+    SDL_Quit();
+    exit(1);
+}
+
+static void audio_callback(void *userdata, Uint8 *stream, int len)
+{
+    chip8_audio_render((struct Chip8Audio *)userdata, stream, len);
+}
+
+// a fresh machine, hooked up to the frontend's diagnostics and profile
+static void reset_machine(struct AppContext *ctx)
+{
+    initialize_chip8(&ctx->chip8);
+    chip8_seed(&ctx->chip8, (uint32_t)time(NULL));
+    ctx->chip8.diag = &ctx->diag;
+#ifdef CHIP8_PROFILE
+    ctx->chip8.profile = &ctx->profile;
+#endif
+}
+
+void app_init(struct AppContext *ctx, const struct Config *config)
+{
+    const char title[] = "CHIP8 Emulator";
+    const int init_components = SDL_INIT_VIDEO | SDL_INIT_AUDIO;
+
+    if (SDL_Init(init_components) != 0)
+    {
+        sdl_error("SDL_Init Error");
+    }
+
+    ctx->window = SDL_CreateWindow(title,
+                                   SDL_WINDOWPOS_CENTERED,
+                                   SDL_WINDOWPOS_CENTERED,
+                                   SCREEN_WIDTH * config->scale,
+                                   SCREEN_HEIGHT * config->scale,
+                                   0);
+
+    if (ctx->window == NULL)
+    {
+        sdl_error("SDL_CreateWindow Error");
+    }
+
+    // unless one is asked for, prefer the gpu and fall back on software
+    ctx->renderer = NULL;
+    if (config->renderer != RENDERER_SOFTWARE)
+    {
+        ctx->renderer = SDL_CreateRenderer(ctx->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    }
+
+    if (ctx->renderer == NULL && config->renderer != RENDERER_GPU)
+    {
+        ctx->renderer = SDL_CreateRenderer(ctx->window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_PRESENTVSYNC);
+    }
+
+    if (ctx->renderer == NULL)
+    {
+        SDL_DestroyWindow(ctx->window);
+        sdl_error("SDL_CreateRenderer Error");
+    }
+
+    ctx->texture = SDL_CreateTexture(ctx->renderer,
+                                     SDL_PIXELFORMAT_ARGB8888,
+                                     SDL_TEXTUREACCESS_STREAMING,
+                                     SCREEN_HIRES_WIDTH,
+                                     SCREEN_HIRES_HEIGHT);
+
+    if (ctx->texture == NULL)
+    {
+        sdl_error("SDL_CreateTexture Error");
+    }
+
+    ctx->redraw = true;
+    ctx->saved_size = 0;
+    ctx->rewinding = false;
+    chip8_diag_init(&ctx->diag);
+#ifdef CHIP8_PROFILE
+    chip8_profile_reset(&ctx->profile);
+    memset(ctx->profile_ticks, 0, sizeof(ctx->profile_ticks));
+#endif
+    reset_machine(ctx);
+    ctx->cycles = 0;
+    ctx->recording = false;
+    ctx->rewind = chip8_rewind_create(REWIND_BYTES, REWIND_KEYFRAME_INTERVAL);
+    if (ctx->rewind == NULL)
+    {
+        printf("Failed to allocate the rewind buffer\n");
+    }
+
+    // init audio
+    // audio beep, the device plays silence whenever the sound timer is zero
+    chip8_audio_init(&ctx->audio, AUDIO_RATE);
+
+    SDL_AudioSpec want, have;
+    SDL_memset(&want, 0, sizeof(want));
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_U8;
+    want.channels = 1;
+    want.samples = AUDIO_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = &ctx->audio;
+
+    ctx->audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (ctx->audio_device == 0)
+    {
+        printf("Failed to open audio: %s\n", SDL_GetError());
+    }
+    else
+    {
+        SDL_PauseAudioDevice(ctx->audio_device, 0);
+    }
+}
+
+bool app_start(struct AppContext *ctx, const struct Config *config)
+{
+    if (!load_rom(config, &ctx->chip8))
+    {
+        return false;
+    }
+
+    if (config->record[0] != '\0')
+    {
+        int error = chip8_record_start(&ctx->recorder, config->record, &ctx->chip8);
+        if (error != CHIP8_OK)
+        {
+            printf("Error: %s %s\n", chip8_strerror(error), config->record);
+            return false;
+        }
+        ctx->recording = true;
+    }
+    return true;
+}
+
+// the recording carries on, the new machine goes into it like a loaded state
+bool app_restart(struct AppContext *ctx, const struct Config *config)
+{
+    reset_machine(ctx);
+    if (!load_rom(config, &ctx->chip8))
+    {
+        return false;
+    }
+
+    ctx->redraw = true;
+    if (ctx->recording)
+    {
+        chip8_record_state(&ctx->recorder, ctx->cycles, &ctx->chip8);
+    }
+    return true;
+}
+
+void app_quit(struct AppContext *ctx, const struct Config *config)
+{
+    if (ctx->recording)
+    {
+        int error = chip8_record_stop(&ctx->recorder, ctx->cycles);
+        if (error != CHIP8_OK)
+        {
+            printf("Error: %s %s\n", chip8_strerror(error), config->record);
+        }
+        ctx->recording = false;
+    }
+    if (ctx->audio_device != 0)
+    {
+        SDL_CloseAudioDevice(ctx->audio_device);
+    }
+    chip8_rewind_destroy(ctx->rewind);
+    SDL_DestroyTexture(ctx->texture);
+    SDL_DestroyRenderer(ctx->renderer);
+    SDL_DestroyWindow(ctx->window);
+    SDL_Quit();
+}
+
+// expands the rows the cpu changed since the last frame into the texture
+// and lets the renderer scale it up to the window in a single copy. the
+// rows stay dirty until draw_frame presented them. returns false when
+// nothing changed and there is nothing to present
+static bool draw_display(struct AppContext *ctx)
+{
+    uint64_t dirty = ctx->chip8.dirty_rows;
+    int width = chip8_screen_width(&ctx->chip8);
+    int height = chip8_screen_height(&ctx->chip8);
+
+    if (dirty == 0 && !ctx->redraw)
+    {
+        return false;
+    }
+
+    if (dirty != 0)
+    {
+        int first = -1;
+        int last = 0;
+
+        for (int y = 0; y < height; y++)
+        {
+            if ((dirty >> y & 1) == 0)
+            {
+                continue;
+            }
+
+            uint32_t *line = &ctx->pixels[y * SCREEN_HIRES_WIDTH];
+            for (int x = 0; x < width; x++)
+            {
+                line[x] = palette[chip8_pixel(&ctx->chip8, x, y)];
+            }
+
+            first = first < 0 ? y : first;
+            last = y;
+        }
+
+        // one upload covering every dirty row. rows below a low res screen
+        // can be marked too, with none above them there's nothing to upload
+        if (first >= 0)
+        {
+            SDL_Rect rect = {0, first, width, last - first + 1};
+            SDL_UpdateTexture(ctx->texture, &rect, &ctx->pixels[first * SCREEN_HIRES_WIDTH], SCREEN_HIRES_WIDTH * sizeof(uint32_t));
+        }
+    }
+
+    // low res only uses the top left corner of the texture
+    SDL_Rect source = {0, 0, width, height};
+    ctx->redraw = false;
+    SDL_RenderCopy(ctx->renderer, ctx->texture, &source, NULL);
+    return true;
+}
+
+void draw_frame(struct AppContext *ctx)
+{
+    uint64_t start = profile_start();
+    if (draw_display(ctx))
+    {
+        SDL_RenderPresent(ctx->renderer);
+        ctx->chip8.dirty_rows = 0;
+    }
+    profile_end(ctx, PROFILE_DRAW, start);
+}
+
+void save_state(struct AppContext *ctx)
+{
+    ctx->saved_size = chip8_save_state(&ctx->chip8, ctx->saved_state, sizeof(ctx->saved_state));
+}
+
+void load_state(struct AppContext *ctx)
+{
+    if (ctx->saved_size == 0)
+    {
+        return;
+    }
+
+    int error = chip8_load_state(&ctx->chip8, ctx->saved_state, ctx->saved_size);
+    if (error != CHIP8_OK)
+    {
+        printf("Error: %s\n", chip8_strerror(error));
+    }
+    else if (ctx->recording)
+    {
+        chip8_record_state(&ctx->recorder, ctx->cycles, &ctx->chip8);
+    }
+}
+
+// keypad changes go through here so a recording sees every one of them
+void set_key(struct AppContext *ctx, int index, bool pressed)
+{
+    handle_keypres(&ctx->chip8, index, pressed);
+    if (ctx->recording)
+    {
+        chip8_record_key(&ctx->recorder, ctx->cycles, index, pressed);
+    }
+}
+
+// run this handle timer in 60HZ
+static void handle_timer(struct AppContext *ctx)
+{
+    chip8_tick_timers(&ctx->chip8);
+    chip8_audio_tick(&ctx->audio, &ctx->chip8);
+    if (ctx->recording)
+    {
+        chip8_record_tick(&ctx->recorder, ctx->cycles);
+    }
+}
+
+// profile_start/profile_end bracket one section of the main loop, they
+// compile to nothing without CHIP8_PROFILE
+uint64_t profile_start(void)
+{
+#ifdef CHIP8_PROFILE
+    return SDL_GetPerformanceCounter();
+#else
+    return 0;
+#endif
+}
+
+void profile_end(struct AppContext *ctx, int section, uint64_t start)
+{
+#ifdef CHIP8_PROFILE
+    ctx->profile_ticks[section] += SDL_GetPerformanceCounter() - start;
+#endif
+}
+
+void print_profile(struct AppContext *ctx)
+{
+#ifdef CHIP8_PROFILE
+    uint64_t total = 0;
+    for (int i = 0; i < PROFILE_SECTIONS; i++)
+    {
+        total += ctx->profile_ticks[i];
+    }
+
+    double frequency = SDL_GetPerformanceFrequency();
+    printf("time:\n");
+    for (int i = 0; i < PROFILE_SECTIONS; i++)
+    {
+        printf("  %-14s %9.3fs %6.2f%%\n",
+               profile_section_names[i],
+               ctx->profile_ticks[i] / frequency,
+               total != 0 ? 100.0 * ctx->profile_ticks[i] / total : 0);
+    }
+    chip8_profile_report(&ctx->profile, stdout);
+#endif
+}
+
+// warnings only, a rom waiting on FX0A is normal
+static void print_diagnostics(struct AppContext *ctx)
+{
+    struct Chip8DiagEvent event;
+    while (chip8_diag_read(&ctx->diag, &event))
+    {
+        if (event.level < CHIP8_DIAG_WARNING)
+        {
+            continue;
+        }
+
+        printf("%s: 0x%04X at 0x%03X", chip8_diag_message(event.code), event.opcode, event.pc);
+        if (event.count > 1)
+        {
+            printf(" (%u times in a row)", event.count);
+        }
+        printf("\n");
+    }
+
+    uint32_t dropped = chip8_diag_dropped(&ctx->diag);
+    if (dropped != 0)
+    {
+        printf("%u diagnostics dropped\n", dropped);
+    }
+}
+
+// one recorded frame back per 60HZ tick, silent while going backwards
+static void rewind_timer(struct AppContext *ctx)
+{
+    chip8_audio_silence(&ctx->audio);
+    if (ctx->rewind != NULL)
+    {
+        chip8_rewind_step(ctx->rewind, &ctx->chip8);
+    }
+}
+
+void scheduler_init(struct Scheduler *sched, uint32_t ips)
+{
+    sched->ips = ips;
+    sched->perf_frequency = SDL_GetPerformanceFrequency();
+    sched->last_counter = SDL_GetPerformanceCounter();
+    sched->cpu_budget = 0;
+    sched->timer_budget = 0;
+    sched->key_wait = false;
+}
+
+void scheduler_run(struct Scheduler *sched, struct AppContext *ctx)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+    double elapsed = (double)(now - sched->last_counter) / sched->perf_frequency;
+    sched->last_counter = now;
+
+    // a sleep on a key wait runs past the cap but isn't a stall, every tick
+    // of it still happens so the timers, rewind and movie stay at 60HZ
+    double capped = elapsed < MAX_CATCHUP_SECONDS ? elapsed : MAX_CATCHUP_SECONDS;
+    sched->cpu_budget += capped * sched->ips;
+    sched->timer_budget += sched->key_wait ? elapsed : capped;
+    sched->key_wait = false;
+
+    uint32_t cycles = (uint32_t)sched->cpu_budget;
+    sched->cpu_budget -= cycles;
+
+    // the cpu stands still while rewinding, the ticks step back instead
+    if (ctx->rewinding)
+    {
+        cycles = 0;
+    }
+
+    uint64_t start = profile_start();
+    uint32_t ran = 0;
+    for (; ran < cycles; ran++)
+    {
+        // a blocked FX0A would only spin, input wakes it up again
+        if (chip8_waiting_for_key(&ctx->chip8))
+        {
+            break;
+        }
+        execute_opcode(&ctx->chip8);
+    }
+    profile_end(ctx, PROFILE_EXECUTE, start);
+
+    // the program wrote the sound timer, pattern or pitch, or a save
+    // state replaced them
+    if (!ctx->rewinding)
+    {
+        chip8_audio_update(&ctx->audio, &ctx->chip8);
+    }
+    ctx->cycles += ran;
+
+    print_diagnostics(ctx);
+
+    start = profile_start();
+    while (sched->timer_budget >= 1.0 / TIMER_HZ)
+    {
+        if (ctx->rewinding)
+        {
+            rewind_timer(ctx);
+        }
+        else
+        {
+            handle_timer(ctx);
+            if (ctx->rewind != NULL)
+            {
+                chip8_rewind_push(ctx->rewind, &ctx->chip8);
+            }
+        }
+        sched->timer_budget -= 1.0 / TIMER_HZ;
+    }
+    profile_end(ctx, PROFILE_TIMERS, start);
+}
+
+void handle_event(struct AppContext *ctx, const SDL_Event *e)
+{
+    switch (e->type)
+    {
+    case SDL_WINDOWEVENT:
+        ctx->redraw = true;
+        break;
+    // the renderer lost what was in the texture, every row has to go up again
+    case SDL_RENDER_TARGETS_RESET:
+    case SDL_RENDER_DEVICE_RESET:
+        ctx->chip8.dirty_rows = ~0ULL;
+        ctx->redraw = true;
+        break;
+    case SDL_KEYDOWN:
+    {
+        if (e->key.keysym.sym == SDLK_F5)
+        {
+            save_state(ctx);
+        }
+        else if (e->key.keysym.sym == SDLK_F9)
+        {
+            load_state(ctx);
+        }
+        else if (e->key.keysym.sym == SDLK_F12)
+        {
+            print_profile(ctx);
+        }
+        else if (e->key.keysym.sym == SDLK_BACKSPACE)
+        {
+            ctx->rewinding = true;
+        }
+
+        int idx = get_app_key_number(e->key.keysym.sym);
+        if (idx != -1)
+        {
+            set_key(ctx, idx, true);
+        }
+
+        break;
+    }
+
+    case SDL_KEYUP:
+    {
+        if (e->key.keysym.sym == SDLK_BACKSPACE)
+        {
+            ctx->rewinding = false;
+            // the movie continues from wherever the rewind stopped
+            if (ctx->recording)
+            {
+                chip8_record_state(&ctx->recorder, ctx->cycles, &ctx->chip8);
+            }
+        }
+
+        int idx = get_app_key_number(e->key.keysym.sym);
+        if (idx != -1)
+        {
+            set_key(ctx, idx, false);
+        }
+
+        break;
+    }
+    }
+}
@@ -0,0 +1,131 @@
+//
+//  frontend.h
+//  first c++ project
+//
+//  SDL frontend shared by the native (main.c) and web (main-web.c)
+//  builds: settings, the window and audio, drawing, the scheduler, save
+//  states, rewind, recording and the keys. Each build only adds its entry
+//  point and the loop pumping events into it.
+//
+
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define TIMER_HZ 60
+#define CONFIG_LINE_MAX 512
+
+enum RendererBackend
+{
+    RENDERER_AUTO, // the gpu, falling back on software
+    RENDERER_GPU,
+    RENDERER_SOFTWARE,
+    RENDERER_BACKENDS
+};
+
+// everything main takes from the command line and the config file, read
+// once before anything starts
+struct Config
+{
+    char rom[CONFIG_LINE_MAX];
+    uint32_t ips;
+    int scale;
+    int renderer;
+    int quirks; // CHIP8_QUIRKS_COUNT unless given, the corpus or the default decides then
+    char corpus[CONFIG_LINE_MAX]; // empty unless given
+    char record[CONFIG_LINE_MAX];
+    bool headless; // no window or audio, run on the library's thread pool and print the result
+    bool bench;    // headless, restart roms that halt and only report the throughput
+    uint32_t instances;
+    int threads;     // headless, 0 for one per core
+    int backend;     // headless, enum Chip8Backend
+    uint64_t cycles; // per instance, headless only
+};
+
+// wall clock time per part of the main loop, reported with the
+// instruction counts when built with make PROFILE=1
+enum ProfileSection
+{
+    PROFILE_EXECUTE,
+    PROFILE_DRAW,
+    PROFILE_TIMERS,
+    PROFILE_EVENTS,
+    PROFILE_SECTIONS
+};
+
+struct AppContext
+{
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture; // 128x64 streaming texture the framebuffer is expanded into
+    uint32_t pixels[SCREEN_HIRES_WIDTH * SCREEN_HIRES_HEIGHT]; // texture contents, only dirty rows get rewritten
+    bool redraw; // window needs repainting even though the screen didn't change
+    uint8_t saved_state[CHIP8_STATE_SIZE]; // quick save slot, F5 saves and F9 restores
+    size_t saved_size;                     // 0 until something was saved
+    struct Chip8Diag diag;                 // what the cpu reported, printed once per frame
+    struct Chip8Rewind *rewind;            // one frame per timer tick, NULL when it couldn't be allocated
+    bool rewinding;                        // backspace is held, time runs backwards
+    uint64_t cycles;                       // instructions executed, the clock movie events are stamped with
+    struct Chip8Recorder recorder;
+    bool recording; // --record was given
+#ifdef CHIP8_PROFILE
+    struct Chip8Profile profile;
+    uint64_t profile_ticks[PROFILE_SECTIONS];
+#endif
+    struct Chip8 chip8;
+    SDL_AudioDeviceID audio_device;
+    struct Chip8Audio audio; // shared with the audio callback
+};
+
+// runs the cpu at a fixed instructions-per-second rate and the delay/sound
+// timers at 60HZ, independent of how long each rendered frame takes
+struct Scheduler
+{
+    uint32_t ips;
+    uint64_t perf_frequency;
+    uint64_t last_counter;
+    double cpu_budget;   // instructions owed to the cpu
+    double timer_budget; // seconds owed to the 60HZ timers
+    bool key_wait;       // the loop slept on purpose while FX0A waited for a key
+};
+
+void config_init(struct Config *config);
+// applies one setting, and returns what was wrong with it or NULL
+const char *set_option(struct Config *config, const char *name, const char *value);
+bool parse_arguments(int argc, char *argv[], struct Config *config);
+void usage(const char *program);
+// reads the rom, with its quirk profile from the corpus when there is one
+bool load_rom(const struct Config *config, struct Chip8 *chip8);
+
+// opens the window and audio, exits when there is no window
+void app_init(struct AppContext *ctx, const struct Config *config);
+// loads the rom and starts recording when asked to, false when either failed
+bool app_start(struct AppContext *ctx, const struct Config *config);
+// starts the rom config names over on a fresh machine, false when it
+// couldn't be loaded
+bool app_restart(struct AppContext *ctx, const struct Config *config);
+// stops the recording and closes everything app_init opened
+void app_quit(struct AppContext *ctx, const struct Config *config);
+
+void scheduler_init(struct Scheduler *sched, uint32_t ips);
+// advance the cpu and timers by the wall clock time since the last call
+void scheduler_run(struct Scheduler *sched, struct AppContext *ctx);
+// keys, quick saves, rewind and window changes. quitting is up to the caller
+void handle_event(struct AppContext *ctx, const SDL_Event *e);
+// draws and presents whatever changed since the last frame
+void draw_frame(struct AppContext *ctx);
+
+void save_state(struct AppContext *ctx);
+void load_state(struct AppContext *ctx);
+void set_key(struct AppContext *ctx, int index, bool pressed);
+
+uint64_t profile_start(void);
+void profile_end(struct AppContext *ctx, int section, uint64_t start);
+void print_profile(struct AppContext *ctx);
+
+#endif